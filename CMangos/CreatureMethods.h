@@ -642,14 +642,18 @@ namespace LuaCreature
     /**
      * Returns all [Unit]s in the [Creature]'s threat list.
      *
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     * @param uint32 maxResults = 0 : the most targets to return, 0 for no limit
+     *
      * @return table targets
      */
     int GetAITargets(lua_State* L, Creature* creature)
     {
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 3, 0);
+
         auto const& threatlist = creature->getThreatManager().getThreatList();
 
-        lua_createtable(L, threatlist.size(), 0);
-        int tbl = lua_gettop(L);
+        int tbl = Eluna::PushResultTable(L, 2, threatlist.size());
         uint32 i = 0;
 
         for (auto itr = threatlist.begin(); itr != threatlist.end(); ++itr)
@@ -659,8 +663,11 @@ namespace LuaCreature
                 continue;
             Eluna::Push(L, target);
             lua_rawseti(L, tbl, ++i);
+            if (i == maxResults)
+                break;
         }
 
+        Eluna::TrimResultTable(L, tbl, i);
         lua_settop(L, tbl);
         return 1;
     }
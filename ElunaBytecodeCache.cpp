@@ -0,0 +1,405 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaBytecodeCache.h"
+#include "ElunaIncludes.h"
+#include "ElunaUtility.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#if !defined MANGOS && !defined VMANGOS
+#define USING_BOOST
+#endif
+
+#ifdef USING_BOOST
+#include <boost/filesystem.hpp>
+#else
+#include <ace/OS_NS_sys_stat.h>
+#endif
+
+extern "C"
+{
+#include "lua.h"
+#include "lauxlib.h"
+};
+
+namespace
+{
+    // Bump when the layout of the cache file header changes
+    const uint32 BYTECODE_CACHE_VERSION = 1;
+    const char BYTECODE_CACHE_MAGIC[4] = { 'E', 'L', 'B', 'C' };
+
+    typedef std::chrono::steady_clock Clock;
+
+    uint64 GetMicroseconds(Clock::time_point start)
+    {
+        return uint64(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count());
+    }
+
+    template<typename T>
+    void Write(std::string& buffer, const T& value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool Read(const std::string& buffer, size_t& offset, T& value)
+    {
+        if (buffer.size() - offset < sizeof(T))
+            return false;
+        memcpy(&value, buffer.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+
+    int DumpWriter(lua_State* /*L*/, const void* p, size_t size, void* ud)
+    {
+        static_cast<std::string*>(ud)->append(static_cast<const char*>(p), size);
+        return 0;
+    }
+}
+
+ElunaBytecodeCache::ElunaBytecodeCache(const std::string& scriptPath) : hits(0), misses(0), savedTime(0), lastCompileTime(0)
+{
+    if (!eConfigMgr->GetBoolDefault("Eluna.BytecodeCache", true))
+        return;
+
+    path = eConfigMgr->GetStringDefault("Eluna.BytecodeCachePath", "");
+    if (path.empty())
+        path = scriptPath + "/.bytecode";
+
+#ifdef USING_BOOST
+    boost::system::error_code ec;
+    boost::filesystem::create_directories(path, ec);
+    if (!boost::filesystem::is_directory(path, ec))
+#else
+    ACE_stat stat_buf;
+    if (ACE_OS::stat(path.c_str(), &stat_buf) == -1 && ACE_OS::mkdir(path.c_str()) == -1)
+#endif
+    {
+        ELUNA_LOG_ERROR("[Eluna]: Unable to create bytecode cache folder `%s`, bytecode cache disabled", path.c_str());
+        path.clear();
+    }
+}
+
+void ElunaBytecodeCache::Precompile(const std::vector<std::string>& filepaths)
+{
+    uint32 threadCount = eConfigMgr->GetIntDefault("Eluna.CompileThreads", 0);
+    if (!threadCount)
+        threadCount = std::thread::hardware_concurrency();
+    if (threadCount > filepaths.size())
+        threadCount = uint32(filepaths.size());
+
+    // Compiling on the calling state is faster than compiling and loading the bytecode again
+    if (threadCount <= 1)
+        return;
+
+    std::vector<Chunk> chunks(filepaths.size());
+
+    // The calling thread compiles its share too
+    std::vector<std::thread> threads;
+    for (uint32 i = 1; i < threadCount; ++i)
+        threads.push_back(std::thread(&ElunaBytecodeCache::PrecompileThread, this, &filepaths, &chunks, i, threadCount));
+    PrecompileThread(&filepaths, &chunks, 0, threadCount);
+
+    for (std::vector<std::thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+        it->join();
+
+    for (std::vector<std::string>::size_type i = 0; i < filepaths.size(); ++i)
+        if (chunks[i].prepared)
+            precompiled[filepaths[i]] = std::move(chunks[i]);
+}
+
+void ElunaBytecodeCache::PrecompileThread(const std::vector<std::string>* filepaths, std::vector<Chunk>* chunks, uint32 first, uint32 step) const
+{
+    lua_State* L = luaL_newstate();
+    if (!L)
+        return;
+
+    for (std::vector<std::string>::size_type i = first; i < filepaths->size(); i += step)
+        Prepare(L, (*filepaths)[i], (*chunks)[i]);
+
+    lua_close(L);
+}
+
+void ElunaBytecodeCache::Prepare(lua_State* L, const std::string& filepath, Chunk& chunk) const
+{
+    // Scripts that can not be read are left for LoadFile to report
+    Source source;
+    if (!ReadSource(filepath, source))
+        return;
+
+    Clock::time_point loadStart = Clock::now();
+    if (IsEnabled() && ReadCached(filepath, source, chunk.data, chunk.compileTime))
+    {
+        chunk.loadTime = GetMicroseconds(loadStart);
+        chunk.cached = true;
+        chunk.prepared = true;
+        return;
+    }
+
+    Clock::time_point compileStart = Clock::now();
+    chunk.status = Compile(L, filepath, source.text);
+    chunk.compileTime = GetMicroseconds(compileStart);
+
+    if (chunk.status)
+    {
+        // Stack: errmsg
+        size_t len;
+        const char* msg = lua_tolstring(L, -1, &len);
+        chunk.data.assign(msg ? msg : "", msg ? len : 0);
+        lua_pop(L, 1);
+        chunk.prepared = true;
+        return;
+    }
+
+    // Stack: chunk
+    bool dumped = Dump(L, chunk.data) == 0;
+    lua_pop(L, 1);
+    if (!dumped)
+    {
+        chunk.data.clear();
+        return;
+    }
+
+    chunk.prepared = true;
+    if (IsEnabled())
+        Save(filepath, source, chunk.data, chunk.compileTime);
+}
+
+int ElunaBytecodeCache::LoadFile(lua_State* L, const std::string& filepath)
+{
+    std::string chunkname = "@" + filepath;
+    lastCompileTime = 0;
+
+    auto it = precompiled.find(filepath);
+    if (it != precompiled.end())
+    {
+        Chunk chunk = std::move(it->second);
+        precompiled.erase(it);
+
+        if (!chunk.cached)
+            lastCompileTime = chunk.compileTime;
+
+        if (chunk.status)
+        {
+            lua_pushlstring(L, chunk.data.data(), chunk.data.size());
+            return chunk.status;
+        }
+
+        Clock::time_point loadStart = Clock::now();
+        if (!luaL_loadbuffer(L, chunk.data.data(), chunk.data.size(), chunkname.c_str()))
+        {
+            if (chunk.cached)
+            {
+                ++hits;
+                uint64 loadTime = chunk.loadTime + GetMicroseconds(loadStart);
+                if (chunk.compileTime > loadTime)
+                    savedTime += chunk.compileTime - loadTime;
+            }
+            else if (IsEnabled())
+                ++misses;
+            return 0;
+        }
+
+        // Cached by a different Lua build, compile it below
+        lua_pop(L, 1);
+    }
+
+    Source source;
+    if (!ReadSource(filepath, source))
+        return luaL_loadfile(L, filepath.c_str());
+
+    if (IsEnabled())
+    {
+        Clock::time_point loadStart = Clock::now();
+        std::string bytecode;
+        uint64 compileTime;
+        if (ReadCached(filepath, source, bytecode, compileTime))
+        {
+            if (!luaL_loadbuffer(L, bytecode.data(), bytecode.size(), chunkname.c_str()))
+            {
+                ++hits;
+                uint64 loadTime = GetMicroseconds(loadStart);
+                if (compileTime > loadTime)
+                    savedTime += compileTime - loadTime;
+                return 0;
+            }
+
+            // Cached by a different Lua build, recompile
+            lua_pop(L, 1);
+        }
+    }
+
+    Clock::time_point compileStart = Clock::now();
+    int status = Compile(L, filepath, source.text);
+    uint64 compileTime = GetMicroseconds(compileStart);
+    lastCompileTime = compileTime;
+    if (status || !IsEnabled())
+        return status;
+
+    ++misses;
+
+    // Stack: chunk
+    std::string bytecode;
+    if (!Dump(L, bytecode))
+        Save(filepath, source, bytecode, compileTime);
+    return 0;
+}
+
+bool ElunaBytecodeCache::ReadCached(const std::string& filepath, const Source& source, std::string& bytecode, uint64& compileTime) const
+{
+    std::string content;
+    if (!ReadFile(GetCacheFile(filepath), content))
+        return false;
+
+    size_t offset = 0;
+    char magic[sizeof(BYTECODE_CACHE_MAGIC)];
+    uint32 version, luaVersion, pathLength;
+    int64 cachedMtime;
+    uint64 cachedSize, cachedHash;
+    if (!Read(content, offset, magic) || memcmp(magic, BYTECODE_CACHE_MAGIC, sizeof(magic)) != 0 ||
+        !Read(content, offset, version) || version != BYTECODE_CACHE_VERSION ||
+        !Read(content, offset, luaVersion) || luaVersion != LUA_VERSION_NUM ||
+        !Read(content, offset, cachedMtime) || cachedMtime != source.mtime ||
+        !Read(content, offset, cachedSize) || cachedSize != source.text.size() ||
+        !Read(content, offset, cachedHash) || cachedHash != source.hash ||
+        !Read(content, offset, compileTime) ||
+        !Read(content, offset, pathLength) || content.size() - offset < pathLength)
+        return false;
+
+    // Different paths may hash to the same cache file
+    if (content.compare(offset, pathLength, filepath) != 0)
+        return false;
+    offset += pathLength;
+
+    bytecode.assign(content, offset, std::string::npos);
+    return true;
+}
+
+void ElunaBytecodeCache::Save(const std::string& filepath, const Source& source, const std::string& bytecode, uint64 compileTime) const
+{
+    std::string content;
+    content.append(BYTECODE_CACHE_MAGIC, sizeof(BYTECODE_CACHE_MAGIC));
+    Write(content, BYTECODE_CACHE_VERSION);
+    Write(content, uint32(LUA_VERSION_NUM));
+    Write(content, source.mtime);
+    Write(content, uint64(source.text.size()));
+    Write(content, source.hash);
+    Write(content, compileTime);
+    Write(content, uint32(filepath.size()));
+    content += filepath;
+    content += bytecode;
+
+    // Write to a temporary file first so an interrupted write can not leave a truncated cache file
+    std::string cacheFile = GetCacheFile(filepath);
+    std::string tempFile = cacheFile + ".tmp";
+    FILE* file = fopen(tempFile.c_str(), "wb");
+    if (!file)
+    {
+        ELUNA_LOG_DEBUG("[Eluna]: Unable to write bytecode cache file `%s`", tempFile.c_str());
+        return;
+    }
+
+    bool written = fwrite(content.data(), 1, content.size(), file) == content.size();
+    written = fclose(file) == 0 && written;
+
+    remove(cacheFile.c_str());
+    if (!written || rename(tempFile.c_str(), cacheFile.c_str()) != 0)
+    {
+        ELUNA_LOG_DEBUG("[Eluna]: Unable to write bytecode cache file `%s`", cacheFile.c_str());
+        remove(tempFile.c_str());
+    }
+}
+
+std::string ElunaBytecodeCache::GetCacheFile(const std::string& filepath) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.luac", static_cast<unsigned long long>(Hash(filepath.data(), filepath.size())));
+    return path + name;
+}
+
+bool ElunaBytecodeCache::ReadSource(const std::string& filepath, Source& source)
+{
+    if (!ReadFile(filepath, source.text) || !GetModifiedTime(filepath, source.mtime))
+        return false;
+
+    source.hash = Hash(source.text.data(), source.text.size());
+    return true;
+}
+
+int ElunaBytecodeCache::Compile(lua_State* L, const std::string& filepath, const std::string& source)
+{
+    // Skip the UTF-8 BOM and a leading # line like luaL_loadfile does, keeping the line numbers
+    size_t start = 0;
+    if (source.compare(0, 3, "\xEF\xBB\xBF") == 0)
+        start = 3;
+    if (start < source.size() && source[start] == '#')
+    {
+        start = source.find('\n', start);
+        if (start == std::string::npos)
+            start = source.size();
+    }
+
+    std::string chunkname = "@" + filepath;
+    return luaL_loadbuffer(L, source.data() + start, source.size() - start, chunkname.c_str());
+}
+
+int ElunaBytecodeCache::Dump(lua_State* L, std::string& bytecode)
+{
+#if LUA_VERSION_NUM >= 503
+    return lua_dump(L, &DumpWriter, &bytecode, 0);
+#else
+    return lua_dump(L, &DumpWriter, &bytecode);
+#endif
+}
+
+bool ElunaBytecodeCache::ReadFile(const std::string& filepath, std::string& content)
+{
+    FILE* file = fopen(filepath.c_str(), "rb");
+    if (!file)
+        return false;
+
+    char buffer[8192];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        content.append(buffer, read);
+
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    return !failed;
+}
+
+bool ElunaBytecodeCache::GetModifiedTime(const std::string& filepath, int64& mtime)
+{
+#ifdef USING_BOOST
+    boost::system::error_code ec;
+    std::time_t time = boost::filesystem::last_write_time(filepath, ec);
+    if (ec)
+        return false;
+    mtime = int64(time);
+#else
+    ACE_stat stat_buf;
+    if (ACE_OS::stat(filepath.c_str(), &stat_buf) == -1)
+        return false;
+    mtime = int64(stat_buf.st_mtime);
+#endif
+    return true;
+}
+
+// 64-bit FNV-1a
+uint64 ElunaBytecodeCache::Hash(const char* data, size_t length, uint64 hash)
+{
+    for (size_t i = 0; i < length; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
@@ -0,0 +1,106 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_BYTECODE_CACHE_H
+#define _ELUNA_BYTECODE_CACHE_H
+
+#include "Common.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct lua_State;
+
+/*
+ * On-disk cache of compiled script chunks made with `lua_dump`.
+ *
+ * Each script has one cache file named after the hash of its path. The file
+ *   header holds the script path, mtime, size and a hash of the source, and the
+ *   cached chunk is only used while all of them match the script on disk.
+ *
+ * Enabled with `Eluna.BytecodeCache`. Files are stored in `Eluna.BytecodeCachePath`,
+ *   by default the hidden `.bytecode` folder inside the script folder.
+ */
+class ElunaBytecodeCache
+{
+public:
+    ElunaBytecodeCache(const std::string& scriptPath);
+
+    /*
+     * Compiles `filepaths` to bytecode on `Eluna.CompileThreads` threads, each
+     *   with its own Lua state, so `LoadFile` only has to load the bytecode.
+     *
+     * Uses the cache like `LoadFile` and writes new cache files.
+     */
+    void Precompile(const std::vector<std::string>& filepaths);
+
+    /*
+     * Works like `luaL_loadfile`: pushes the compiled chunk of `filepath`, or an
+     *   error message if loading failed, and returns the status.
+     *
+     * The chunk is taken from `Precompile` or the cache if possible, otherwise
+     *   the source is compiled and the cache file is rewritten.
+     */
+    int LoadFile(lua_State* L, const std::string& filepath);
+
+    bool IsEnabled() const { return !path.empty(); }
+    uint32 GetHits() const { return hits; }
+    uint32 GetMisses() const { return misses; }
+    // Compile time of the cached chunks minus the time it took to load them, in microseconds
+    uint64 GetSavedTime() const { return savedTime; }
+    // Time spent compiling the file of the last LoadFile, 0 if it came from the cache, in microseconds
+    uint64 GetLastCompileTime() const { return lastCompileTime; }
+
+private:
+    struct Source
+    {
+        std::string text;
+        int64 mtime;
+        uint64 hash;
+    };
+
+    // A script compiled by `Precompile`
+    struct Chunk
+    {
+        Chunk() : prepared(false), status(0), cached(false), compileTime(0), loadTime(0) { }
+
+        bool prepared;
+        int status;
+        // Bytecode, or the error message if status is not 0
+        std::string data;
+        bool cached;
+        uint64 compileTime;
+        uint64 loadTime;
+    };
+
+    void PrecompileThread(const std::vector<std::string>* filepaths, std::vector<Chunk>* chunks, uint32 first, uint32 step) const;
+    // Fills `chunk` with the bytecode of `filepath`, using `L` to compile it
+    void Prepare(lua_State* L, const std::string& filepath, Chunk& chunk) const;
+    bool ReadCached(const std::string& filepath, const Source& source, std::string& bytecode, uint64& compileTime) const;
+    void Save(const std::string& filepath, const Source& source, const std::string& bytecode, uint64 compileTime) const;
+    std::string GetCacheFile(const std::string& filepath) const;
+
+    static bool ReadSource(const std::string& filepath, Source& source);
+    // Compiles the source like luaL_loadfile, skipping a UTF-8 BOM and a leading # line
+    static int Compile(lua_State* L, const std::string& filepath, const std::string& source);
+    static int Dump(lua_State* L, std::string& bytecode);
+    static bool ReadFile(const std::string& filepath, std::string& content);
+    static bool GetModifiedTime(const std::string& filepath, int64& mtime);
+    static uint64 Hash(const char* data, size_t length, uint64 hash = 14695981039346656037ULL);
+
+    // Cache folder, empty if the cache is disabled
+    std::string path;
+
+    // Chunks made by Precompile, by script path
+    std::unordered_map<std::string, Chunk> precompiled;
+
+    uint32 hits;
+    uint32 misses;
+    uint64 savedTime;
+    uint64 lastCompileTime;
+};
+
+#endif
@@ -0,0 +1,161 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaChannelMgr.h"
+#include "LuaEngine.h"
+#include "ElunaIncludes.h"
+#include <algorithm>
+
+extern "C"
+{
+#include "lua.h"
+#include "lauxlib.h"
+};
+
+std::vector<ElunaChannelMgr*> ElunaChannelMgr::inboxes;
+ElunaChannelMgr::LockType ElunaChannelMgr::inboxLock;
+
+ElunaChannelMgr::ElunaChannelMgr(Eluna* _E) : E(_E), dispatching(false), pending(0), sent(0), received(0), dropped(0), delivered(0)
+{
+    capacity = eConfigMgr->GetIntDefault("Eluna.ChannelQueueSize", 10000);
+    drainLimit = eConfigMgr->GetIntDefault("Eluna.ChannelDrainLimit", 1000);
+
+    Guard guard(inboxLock);
+    inboxes.push_back(this);
+}
+
+ElunaChannelMgr::~ElunaChannelMgr()
+{
+    Guard guard(inboxLock);
+    inboxes.erase(std::remove(inboxes.begin(), inboxes.end(), this), inboxes.end());
+}
+
+uint32 ElunaChannelMgr::Send(const std::string& channel, const std::string& data)
+{
+    sent.fetch_add(1, std::memory_order_relaxed);
+
+    uint32 accepted = 0;
+    Guard guard(inboxLock);
+    for (std::vector<ElunaChannelMgr*>::const_iterator it = inboxes.begin(); it != inboxes.end(); ++it)
+    {
+        ElunaChannelMgr* inbox = *it;
+        if (!inbox->HasHandlers(channel))
+            continue;
+
+        if (inbox->Post(new ElunaMessage(channel, data)))
+            ++accepted;
+    }
+    return accepted;
+}
+
+bool ElunaChannelMgr::Post(ElunaMessage* msg)
+{
+    // Reserve a slot first so concurrent senders can not overshoot the capacity, 0 is unlimited
+    if (pending.fetch_add(1, std::memory_order_acq_rel) >= capacity && capacity)
+    {
+        pending.fetch_sub(1, std::memory_order_acq_rel);
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        delete msg;
+        return false;
+    }
+
+    received.fetch_add(1, std::memory_order_relaxed);
+    queue.Enqueue(msg);
+    return true;
+}
+
+uint32 ElunaChannelMgr::Drain(MessageList& messages, uint32 limit)
+{
+    uint32 count = 0;
+    ElunaMessage* msg;
+    while ((!limit || count < limit) && queue.Dequeue(msg))
+    {
+        messages.push_back(msg);
+        ++count;
+    }
+
+    if (count)
+        pending.fetch_sub(count, std::memory_order_acq_rel);
+    return count;
+}
+
+void ElunaChannelMgr::Update()
+{
+    MessageList messages;
+    if (!Drain(messages, drainLimit))
+        return;
+
+    dispatching = true;
+    for (MessageList::const_iterator it = messages.begin(); it != messages.end(); ++it)
+    {
+        ElunaMessage* msg = *it;
+
+        // Handlers can be (un)registered while handling, so call the ones that existed on arrival
+        HandlerMap::const_iterator itr = handlers.find(msg->channel);
+        if (itr != handlers.end() && E->HasLuaState())
+        {
+            std::vector<int> functionRefs = itr->second;
+            E->OnChannelMessage(functionRefs, msg->channel, msg->data);
+            delivered.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        delete msg;
+    }
+    dispatching = false;
+
+    // Handlers cleared while dispatching may still have been in a copied handler list
+    if (!releasedRefs.empty())
+    {
+        if (E->HasLuaState())
+        {
+            for (std::vector<int>::const_iterator it = releasedRefs.begin(); it != releasedRefs.end(); ++it)
+                luaL_unref(E->L, LUA_REGISTRYINDEX, *it);
+        }
+        releasedRefs.clear();
+    }
+}
+
+void ElunaChannelMgr::AddHandler(const std::string& channel, int functionRef)
+{
+    handlers[channel].push_back(functionRef);
+
+    Guard guard(channelLock);
+    channels.insert(channel);
+}
+
+void ElunaChannelMgr::ClearHandlers(const std::string& channel)
+{
+    HandlerMap::iterator it = handlers.find(channel);
+    if (it != handlers.end())
+    {
+        if (dispatching)
+            releasedRefs.insert(releasedRefs.end(), it->second.begin(), it->second.end());
+        else if (E->HasLuaState())
+        {
+            for (std::vector<int>::const_iterator itr = it->second.begin(); itr != it->second.end(); ++itr)
+                luaL_unref(E->L, LUA_REGISTRYINDEX, *itr);
+        }
+        handlers.erase(it);
+    }
+
+    Guard guard(channelLock);
+    channels.erase(channel);
+}
+
+void ElunaChannelMgr::ClearHandlers()
+{
+    handlers.clear();
+    releasedRefs.clear();
+
+    Guard guard(channelLock);
+    channels.clear();
+}
+
+bool ElunaChannelMgr::HasHandlers(const std::string& channel)
+{
+    Guard guard(channelLock);
+    return channels.find(channel) != channels.end();
+}
@@ -0,0 +1,111 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_CHANNEL_MGR_H
+#define _ELUNA_CHANNEL_MGR_H
+
+#include "ElunaUtility.h"
+#include "Common.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Eluna;
+
+/*
+ * A value sent to a channel, serialized with lmarshal.
+ */
+struct ElunaMessage
+{
+    ElunaMessage(const std::string& _channel, const std::string& _data) : channel(_channel), data(_data) { }
+
+    std::string channel;
+    std::string data;
+};
+
+/*
+ * Inbox for the messages sent to an Eluna state through named channels.
+ *
+ * Any thread can post to any inbox without locking. The owning state drains
+ *   its inbox on world update and calls the handlers of each message's channel.
+ *
+ * Every inbox holds at most `Eluna.ChannelQueueSize` pending messages.
+ * Messages posted to a full inbox are dropped and counted, so a state that
+ *   sends faster than the receiver handles can not grow the queue forever.
+ */
+class ElunaChannelMgr
+{
+public:
+    typedef std::vector<ElunaMessage*> MessageList;
+    typedef std::unordered_map<std::string, std::vector<int> > HandlerMap;
+
+    ElunaChannelMgr(Eluna* _E);
+    ~ElunaChannelMgr();
+
+    /*
+     * Posts a copy of the serialized value `data` to every inbox that has
+     *   handlers for `channel`, including this one.
+     *
+     * Returns the amount of inboxes that accepted the message.
+     */
+    uint32 Send(const std::string& channel, const std::string& data);
+
+    // Takes ownership of `msg`. Returns false and deletes `msg` if the inbox is full.
+    bool Post(ElunaMessage* msg);
+    // Moves up to `limit` pending messages to `messages` in the order they were posted.
+    uint32 Drain(MessageList& messages, uint32 limit);
+    // Delivers pending messages to the handlers, should only be called by the owning state.
+    void Update();
+
+    void AddHandler(const std::string& channel, int functionRef);
+    void ClearHandlers(const std::string& channel);
+    // Forgets all handlers without unreferencing them, used when the Lua state is closed.
+    void ClearHandlers();
+    bool HasHandlers(const std::string& channel);
+
+    uint32 GetPending() const { return pending.load(std::memory_order_relaxed); }
+    uint64 GetSent() const { return sent.load(std::memory_order_relaxed); }
+    uint64 GetReceived() const { return received.load(std::memory_order_relaxed); }
+    uint64 GetDropped() const { return dropped.load(std::memory_order_relaxed); }
+    uint64 GetDelivered() const { return delivered.load(std::memory_order_relaxed); }
+    uint32 GetCapacity() const { return capacity; }
+
+private:
+    typedef std::mutex LockType;
+    typedef std::lock_guard<LockType> Guard;
+
+    // All existing inboxes
+    static std::vector<ElunaChannelMgr*> inboxes;
+    static LockType inboxLock;
+
+    Eluna* E;
+    ElunaUtil::MPSCQueue<ElunaMessage> queue;
+
+    // Channels with handlers, read by other threads when broadcasting
+    std::unordered_set<std::string> channels;
+    LockType channelLock;
+    // Handlers are only touched by the owning state
+    HandlerMap handlers;
+    // Set while Update calls handlers, refs of handlers cleared meanwhile go to `releasedRefs`
+    //   and are unreferenced once Update is done, so no ref it still holds is reused
+    bool dispatching;
+    std::vector<int> releasedRefs;
+
+    std::atomic<uint32> pending;
+    std::atomic<uint64> sent;
+    std::atomic<uint64> received;
+    std::atomic<uint64> dropped;
+    std::atomic<uint64> delivered;
+
+    uint32 capacity;
+    uint32 drainLimit;
+
+    // Prevent copy
+    ElunaChannelMgr(ElunaChannelMgr const&) = delete;
+    ElunaChannelMgr& operator=(const ElunaChannelMgr&) = delete;
+};
+
+#endif
@@ -105,6 +105,19 @@ void ElunaEventProcessor::SetState(int eventId, LuaEventState state)
         eventMap.erase(eventId);
 }
 
+void ElunaEventProcessor::SetModuleStates(uint32 module, LuaEventState state)
+{
+    for (EventList::iterator it = eventList.begin(); it != eventList.end(); ++it)
+    {
+        if (it->second->module != module)
+            continue;
+
+        it->second->SetState(state);
+        if (state == LUAEVENT_STATE_ERASE)
+            eventMap.erase(it->second->funcRef);
+    }
+}
+
 void ElunaEventProcessor::AddEvent(LuaEvent* luaEvent)
 {
     luaEvent->GenerateDelay();
@@ -114,7 +127,9 @@ void ElunaEventProcessor::AddEvent(LuaEvent* luaEvent)
 
 void ElunaEventProcessor::AddEvent(int funcRef, uint32 min, uint32 max, uint32 repeats)
 {
-    AddEvent(new LuaEvent(funcRef, min, max, repeats));
+    LuaEvent* luaEvent = new LuaEvent(funcRef, min, max, repeats);
+    luaEvent->module = (*E)->AddModuleEvent();
+    AddEvent(luaEvent);
 }
 
 void ElunaEventProcessor::RemoveEvent(LuaEvent* luaEvent)
@@ -162,3 +177,12 @@ void EventMgr::SetState(int eventId, LuaEventState state)
             (*it)->SetState(eventId, state);
     globalProcessor->SetState(eventId, state);
 }
+
+void EventMgr::SetModuleStates(uint32 module, LuaEventState state)
+{
+    Guard guard(GetLock());
+    if (!processors.empty())
+        for (ProcessorSet::const_iterator it = processors.begin(); it != processors.end(); ++it) // loop processors
+            (*it)->SetModuleStates(module, state);
+    globalProcessor->SetModuleStates(module, state);
+}
@@ -39,7 +39,7 @@ enum LuaEventState
 struct LuaEvent
 {
     LuaEvent(int _funcRef, uint32 _min, uint32 _max, uint32 _repeats) :
-        min(_min), max(_max), delay(0), repeats(_repeats), funcRef(_funcRef), state(LUAEVENT_STATE_RUN)
+        min(_min), max(_max), delay(0), repeats(_repeats), funcRef(_funcRef), module(0), state(LUAEVENT_STATE_RUN)
     {
     }
 
@@ -59,6 +59,7 @@ struct LuaEvent
     uint32 delay; // The currently used waiting time
     uint32 repeats; // Amount of repeats to make, 0 for infinite
     int funcRef;    // Lua function reference ID, also used as event ID
+    uint32 module;  // ID of the module that registered the event while loading, 0 if none
     LuaEventState state;    // State for next call
 };
 
@@ -78,6 +79,8 @@ public:
     void SetStates(LuaEventState state);
     // set the event to be removed when executing
     void SetState(int eventId, LuaEventState state);
+    // sets the state of the events registered by the module
+    void SetModuleStates(uint32 module, LuaEventState state);
     void AddEvent(int funcRef, uint32 min, uint32 max, uint32 repeats);
     EventMap eventMap;
 
@@ -109,6 +112,10 @@ public:
     // Sets the eventId's state in all processors
     // Execute only in safe env
     void SetState(int eventId, LuaEventState state);
+
+    // Sets the state of the events registered by the module in all processors
+    // Execute only in safe env
+    void SetModuleStates(uint32 module, LuaEventState state);
 };
 
 #endif
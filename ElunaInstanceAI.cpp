@@ -5,9 +5,13 @@
  */
 
 #include "ElunaInstanceAI.h"
+#include "ElunaInstanceSaver.h"
 #include "ElunaUtility.h"
 #include "lmarshal.h"
+#include <cstring>
 
+ElunaInstanceAI::SaveFormat ElunaInstanceAI::saveFormat = ElunaInstanceAI::SAVE_FORMAT_BASE64;
+bool ElunaInstanceAI::saveCompact = false;
 
 #ifndef TRINITY
 void ElunaInstanceAI::Initialize()
@@ -20,6 +24,7 @@ void ElunaInstanceAI::Initialize()
     lua_State* L = sEluna->L;
     lua_newtable(L);
     sEluna->CreateInstanceData(instance);
+    ResetDataSlots();
 
     sEluna->OnInitialize(this);
 }
@@ -38,6 +43,8 @@ void ElunaInstanceAI::Load(const char* data)
     else // Otherwise, copy the new data into our buffer.
     {
         lastSaveData.assign(data);
+        lastSnapshot.clear();
+        snapshotQueued = false;
     }
 
     if (data[0] == '\0')
@@ -48,51 +55,80 @@ void ElunaInstanceAI::Load(const char* data)
         lua_State* L = sEluna->L;
         lua_newtable(L);
         sEluna->CreateInstanceData(instance);
+        ResetDataSlots();
 
         sEluna->OnLoad(this);
         // Stack: (empty)
         return;
     }
 
-    size_t decodedLength;
-    const unsigned char* decodedData = ElunaUtil::DecodeData(data, &decodedLength);
-    lua_State* L = sEluna->L;
-
-    if (decodedData)
+    // Data saved in the binary format starts with a header, otherwise it's Base-64.
+    //   Both are always accepted, so switching `Eluna.InstanceSaveFormat` upgrades
+    //   the existing data on the next save.
+    std::string decodedData;
+    bool decoded;
+    if (ElunaUtil::IsBinaryData(data))
+        decoded = ElunaUtil::DecodeBinaryData(data, decodedData);
+    else
     {
-        // Stack: (empty)
+        size_t decodedLength;
+        unsigned char* base64Data = ElunaUtil::DecodeData(data, &decodedLength);
+        decoded = base64Data != NULL;
+        if (decoded)
+        {
+            decodedData.assign((const char*)base64Data, decodedLength);
+            delete[] base64Data;
+        }
+    }
+    if (decoded)
+    {
+        // The data only needs to be saved again if it changes,
+        //   or to upgrade it to the configured save format.
+        LoadMarshalled(decodedData, ElunaUtil::IsBinaryData(data) == (saveFormat != SAVE_FORMAT_BASE64));
+    }
+    else
+    {
+        ELUNA_LOG_ERROR("Error while decoding instance data: Data is not valid base-64 or binary save data");
 
-        lua_pushcfunction(L, mar_decode);
-        lua_pushlstring(L, (const char*)decodedData, decodedLength);
-        // Stack: mar_decode, decoded_data
+#ifndef TRINITY
+        Initialize();
+#endif
+    }
+}
 
-        // Call `mar_decode` and check for success.
-        if (lua_pcall(L, 1, 1, 0) == 0)
+void ElunaInstanceAI::LoadMarshalled(const std::string& data, bool upToDate)
+{
+    lua_State* L = sEluna->L;
+    // Stack: (empty)
+
+    lua_pushcfunction(L, mar_decode);
+    lua_pushlstring(L, data.data(), data.size());
+    // Stack: mar_decode, decoded_data
+
+    // Call `mar_decode` and check for success.
+    if (lua_pcall(L, 1, 1, 0) == 0)
+    {
+        // Stack: data
+        // Only use the data if it's a table.
+        if (lua_istable(L, -1))
         {
-            // Stack: data
-            // Only use the data if it's a table.
-            if (lua_istable(L, -1))
+            sEluna->CreateInstanceData(instance);
+            ResetDataSlots();
+            // Stack: (empty)
+
+            if (upToDate)
             {
-                sEluna->CreateInstanceData(instance);
-                // Stack: (empty)
-                sEluna->OnLoad(this);
-                // WARNING! lastSaveData might be different after `OnLoad` if the Lua code saved data.
+                sEluna->SetInstanceDataDirty(instance, false);
+                if (&data != &lastSnapshot)
+                    lastSnapshot = data;
             }
-            else
-            {
-                ELUNA_LOG_ERROR("Error while loading instance data: Expected data to be a table (type 5), got type %d instead", lua_type(L, -1));
-                lua_pop(L, 1);
-                // Stack: (empty)
 
-#ifndef TRINITY
-                Initialize();
-#endif
-            }
+            sEluna->OnLoad(this);
+            // WARNING! lastSaveData might be different after `OnLoad` if the Lua code saved data.
         }
         else
         {
-            // Stack: error_message
-            ELUNA_LOG_ERROR("Error while parsing instance data with lua-marshal: %s", lua_tostring(L, -1));
+            ELUNA_LOG_ERROR("Error while loading instance data: Expected data to be a table (type 5), got type %d instead", lua_type(L, -1));
             lua_pop(L, 1);
             // Stack: (empty)
 
@@ -100,12 +136,13 @@ void ElunaInstanceAI::Load(const char* data)
             Initialize();
 #endif
         }
-
-        delete[] decodedData;
     }
     else
     {
-        ELUNA_LOG_ERROR("Error while decoding instance data: Data is not valid base-64");
+        // Stack: error_message
+        ELUNA_LOG_ERROR("Error while parsing instance data with lua-marshal: %s", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        // Stack: (empty)
 
 #ifndef TRINITY
         Initialize();
@@ -113,12 +150,28 @@ void ElunaInstanceAI::Load(const char* data)
     }
 }
 
-const char* ElunaInstanceAI::Save() const
+void ElunaInstanceAI::Reload()
 {
     LOCK_ELUNA;
-    lua_State* L = sEluna->L;
-    // Stack: (empty)
 
+    // Saves written by the instance saver never went through `lastSaveData`,
+    //   and the marshalled data doesn't have to be decoded
+    if (!lastSnapshot.empty())
+        LoadMarshalled(lastSnapshot, true);
+    else
+        Load(NULL);
+}
+
+void ElunaInstanceAI::EncodeSaveData(const std::string& data, std::string& output)
+{
+    if (saveFormat == SAVE_FORMAT_BASE64)
+        ElunaUtil::EncodeData((const unsigned char*)data.data(), data.size(), output);
+    else
+        ElunaUtil::EncodeBinaryData((const unsigned char*)data.data(), data.size(), output, saveFormat == SAVE_FORMAT_BINARY_COMPRESSED);
+}
+
+const char* ElunaInstanceAI::Save() const
+{
     /*
      * Need to cheat because this method actually does modify this instance,
      *   even though it's declared as `const`.
@@ -127,37 +180,105 @@ const char* ElunaInstanceAI::Save() const
      * Don't dictate to children that their methods must be pure.
      */
     ElunaInstanceAI* self = const_cast<ElunaInstanceAI*>(this);
+    ElunaInstanceSaver* saver = sEluna->instanceSaver;
 
-    lua_pushcfunction(L, mar_encode);
-    sEluna->PushInstanceData(L, self, false);
-    // Stack: mar_encode, instance_data
-
-    if (lua_pcall(L, 1, 1, 0) != 0)
+    // Only marshalling the data needs the Lua state, encoding is done without the lock
+    std::string data;
     {
-        // Stack: error_message
-        ELUNA_LOG_ERROR("Error while saving: %s", lua_tostring(L, -1));
-        lua_pop(L, 1);
-        return NULL;
+        LOCK_ELUNA;
+        lua_State* L = sEluna->L;
+        // Stack: (empty)
+
+        // Check if the instance data is missing (i.e. someone reloaded Eluna).
+        if (!sEluna->HasInstanceData(instance))
+            self->Reload();
+
+        // Pushing the data writes the pending data slots to it
+        if (dataSlotsPending)
+        {
+            sEluna->PushInstanceData(L, self, false, false);
+            lua_pop(L, 1);
+        }
+
+        // Data that Lua could have written to since it was last saved or loaded is
+        //   marshalled and compared, most hooks only read it
+        bool changed = false;
+        if (sEluna->IsInstanceDataDirty(instance))
+        {
+            lua_pushcfunction(L, saveCompact ? mar_encode_compact : mar_encode);
+            sEluna->PushInstanceData(L, self, false, false);
+            // Stack: mar_encode, instance_data
+
+            if (lua_pcall(L, 1, 1, 0) != 0)
+            {
+                // Stack: error_message
+                ELUNA_LOG_ERROR("Error while saving: %s", lua_tostring(L, -1));
+                lua_pop(L, 1);
+                return NULL;
+            }
+
+            // Stack: data
+            size_t dataLength;
+            const char* marshalled = lua_tolstring(L, -1, &dataLength);
+            changed = lastSnapshot.size() != dataLength || memcmp(lastSnapshot.data(), marshalled, dataLength) != 0;
+            if (changed)
+                data.assign(marshalled, dataLength);
+
+            lua_pop(L, 1);
+            // Stack: (empty)
+
+            sEluna->SetInstanceDataDirty(instance, false);
+        }
+
+        // `lastSaveData` is still up to date, unless newer data went to the instance saver
+        if (!changed && !snapshotQueued)
+            return lastSaveData.c_str();
     }
 
-    // Stack: data
-    size_t dataLength;
-    const unsigned char* data = (const unsigned char*)lua_tolstring(L, -1, &dataLength);
-    ElunaUtil::EncodeData(data, dataLength, self->lastSaveData);
+    uint32 completedEncounters = 0;
+#if defined TRINITY || AZEROTHCORE
+    completedEncounters = GetCompletedEncounterMask();
+#endif
 
-    lua_pop(L, 1);
-    // Stack: (empty)
+    if (saver->IsEnabled())
+    {
+        // The saver already has the data, it's queued again only if the completed
+        //   encounters changed. An empty string makes the core skip its write,
+        //   so the saver writes the completed encounters too.
+        if (!changed)
+        {
+            if (completedEncounters == snapshotEncounters)
+                return "";
+            data = lastSnapshot;
+        }
+        saver->Queue(instance->GetInstanceId(), completedEncounters, data);
+        self->lastSnapshot.swap(data);
+        self->snapshotQueued = true;
+        self->snapshotEncounters = completedEncounters;
+        return "";
+    }
 
+    // The saver stopped with newer data than the core has, which the core writes from now on
+    if (!changed)
+        data = lastSnapshot;
+
+    EncodeSaveData(data, self->lastSaveData);
+    self->lastSnapshot.swap(data);
+    self->snapshotQueued = false;
     return lastSaveData.c_str();
 }
 
 uint32 ElunaInstanceAI::GetData(uint32 key) const
 {
+    uint64 cached;
+    if (GetDataSlot(key, cached))
+        return uint32(cached);
+
     LOCK_ELUNA;
     lua_State* L = sEluna->L;
     // Stack: (empty)
 
-    sEluna->PushInstanceData(L, const_cast<ElunaInstanceAI*>(this), false);
+    sEluna->PushInstanceData(L, const_cast<ElunaInstanceAI*>(this), false, false);
     // Stack: instance_data
 
     Eluna::Push(L, key);
@@ -166,6 +287,7 @@ uint32 ElunaInstanceAI::GetData(uint32 key) const
     lua_gettable(L, -2);
     // Stack: instance_data, value
 
+    FillDataSlot(key, L, -1);
     uint32 value = Eluna::CHECKVAL<uint32>(L, -1, 0);
     lua_pop(L, 2);
     // Stack: (empty)
@@ -175,11 +297,14 @@ uint32 ElunaInstanceAI::GetData(uint32 key) const
 
 void ElunaInstanceAI::SetData(uint32 key, uint32 value)
 {
+    if (SetDataSlot(key, DATA_SLOT_NUMBER, value))
+        return;
+
     LOCK_ELUNA;
     lua_State* L = sEluna->L;
     // Stack: (empty)
 
-    sEluna->PushInstanceData(L, this, false);
+    sEluna->PushInstanceData(L, this, false, false);
     // Stack: instance_data
 
     Eluna::Push(L, key);
@@ -191,15 +316,21 @@ void ElunaInstanceAI::SetData(uint32 key, uint32 value)
 
     lua_pop(L, 1);
     // Stack: (empty)
+
+    sEluna->SetInstanceDataDirty(instance, true);
 }
 
 uint64 ElunaInstanceAI::GetData64(uint32 key) const
 {
+    uint64 cached;
+    if (GetDataSlot(key, cached))
+        return cached;
+
     LOCK_ELUNA;
     lua_State* L = sEluna->L;
     // Stack: (empty)
 
-    sEluna->PushInstanceData(L, const_cast<ElunaInstanceAI*>(this), false);
+    sEluna->PushInstanceData(L, const_cast<ElunaInstanceAI*>(this), false, false);
     // Stack: instance_data
 
     Eluna::Push(L, key);
@@ -208,6 +339,7 @@ uint64 ElunaInstanceAI::GetData64(uint32 key) const
     lua_gettable(L, -2);
     // Stack: instance_data, value
 
+    FillDataSlot(key, L, -1);
     uint64 value = Eluna::CHECKVAL<uint64>(L, -1, 0);
     lua_pop(L, 2);
     // Stack: (empty)
@@ -217,11 +349,14 @@ uint64 ElunaInstanceAI::GetData64(uint32 key) const
 
 void ElunaInstanceAI::SetData64(uint32 key, uint64 value)
 {
+    if (SetDataSlot(key, DATA_SLOT_UINT64, value))
+        return;
+
     LOCK_ELUNA;
     lua_State* L = sEluna->L;
     // Stack: (empty)
 
-    sEluna->PushInstanceData(L, this, false);
+    sEluna->PushInstanceData(L, this, false, false);
     // Stack: instance_data
 
     Eluna::Push(L, key);
@@ -233,4 +368,108 @@ void ElunaInstanceAI::SetData64(uint32 key, uint64 value)
 
     lua_pop(L, 1);
     // Stack: (empty)
+
+    sEluna->SetInstanceDataDirty(instance, true);
+}
+
+bool ElunaInstanceAI::HasDataSlot(uint32 key) const
+{
+    return key < DATA_SLOT_COUNT && instance->Instanceable();
+}
+
+bool ElunaInstanceAI::GetDataSlot(uint32 key, uint64& value) const
+{
+    if (!HasDataSlot(key))
+        return false;
+
+    std::lock_guard<std::mutex> guard(dataSlotsLock);
+    DataSlot const& slot = dataSlots[key];
+    if (slot.state == DATA_SLOT_EMPTY)
+        return false;
+
+    value = slot.value;
+    return true;
+}
+
+bool ElunaInstanceAI::SetDataSlot(uint32 key, DataSlotState state, uint64 value)
+{
+    if (!HasDataSlot(key))
+        return false;
+
+    std::lock_guard<std::mutex> guard(dataSlotsLock);
+    DataSlot& slot = dataSlots[key];
+    slot.state = state;
+    slot.value = value;
+    slot.pending = true;
+    dataSlotsPending = true;
+    return true;
+}
+
+void ElunaInstanceAI::FillDataSlot(uint32 key, lua_State* L, int index) const
+{
+    if (!HasDataSlot(key))
+        return;
+
+    // Only values that GetData and GetData64 read the same are cached,
+    //   anything else is converted (or rejected) by CHECKVAL on every read.
+    DataSlotState state;
+    uint64 value = 0;
+    if (lua_isnil(L, index))
+        state = DATA_SLOT_NIL;
+    else if (lua_type(L, index) == LUA_TNUMBER)
+    {
+        lua_Number number = lua_tonumber(L, index);
+        if (number < 0 || number > UINT32_MAX)
+            return;
+        state = DATA_SLOT_NUMBER;
+        value = uint32(number);
+    }
+    else
+        return;
+
+    std::lock_guard<std::mutex> guard(dataSlotsLock);
+    DataSlot& slot = dataSlots[key];
+    // SetData might have been called since the table was read
+    if (slot.state != DATA_SLOT_EMPTY)
+        return;
+    slot.state = state;
+    slot.value = value;
+}
+
+void ElunaInstanceAI::ResetDataSlots()
+{
+    std::lock_guard<std::mutex> guard(dataSlotsLock);
+    for (uint32 i = 0; i < DATA_SLOT_COUNT; ++i)
+    {
+        if (!dataSlots[i].pending)
+            dataSlots[i].state = DATA_SLOT_EMPTY;
+    }
+}
+
+bool ElunaInstanceAI::FlushDataSlots(lua_State* L, int index)
+{
+    if (!dataSlotsPending)
+        return false;
+
+    index = lua_absindex(L, index);
+
+    bool written = false;
+    std::lock_guard<std::mutex> guard(dataSlotsLock);
+    for (uint32 i = 0; i < DATA_SLOT_COUNT; ++i)
+    {
+        DataSlot& slot = dataSlots[i];
+        if (!slot.pending)
+            continue;
+
+        Eluna::Push(L, i);
+        if (slot.state == DATA_SLOT_UINT64)
+            Eluna::Push(L, slot.value);
+        else
+            Eluna::Push(L, uint32(slot.value));
+        lua_rawset(L, index);
+        slot.pending = false;
+        written = true;
+    }
+    dataSlotsPending = false;
+    return written;
 }
@@ -20,6 +20,9 @@
 #include "Map.h"
 #endif
 
+#include <atomic>
+#include <mutex>
+
 /*
  * This class is a small wrapper around `InstanceData`,
  *   allowing instances to be scripted with Eluna.
@@ -64,14 +67,81 @@ private:
     // The last save data to pass through this class,
     //   either through `Load` or `Save`.
     std::string lastSaveData;
+    // The last saved or loaded data, marshalled but not encoded, or empty if unknown.
+    //   Dirty data that marshals to the same is not saved again.
+    std::string lastSnapshot;
+    // Set when `lastSnapshot` went to the instance saver, so it's newer than `lastSaveData`
+    bool snapshotQueued;
+    // The completed encounters queued along with `lastSnapshot`
+    uint32 snapshotEncounters;
+
+    // Creates the instance data from the marshalled `data`, which is clean if `upToDate` is set
+    void LoadMarshalled(const std::string& data, bool upToDate);
+
+    /*
+     * Integer keys below `DATA_SLOT_COUNT` have a slot that caches their value
+     *   for `GetData` and `GetData64`, so reading them needs neither the Eluna lock
+     *   nor the Lua state once the slot is filled.
+     *
+     * `SetData` and `SetData64` only write the slot and mark it pending. Pending
+     *   slots are written to the Lua table whenever the table is pushed, so Lua
+     *   sees a `SetData` made while its hook runs from the next push on.
+     * Lua can write any key once the table is passed to a script, so that empties
+     *   all slots that are not pending, and so does replacing the table on a
+     *   (re)load. Pending slots survive a reload.
+     *
+     * Continents have no slots, their data is shared by every map of the continent.
+     */
+    static const uint32 DATA_SLOT_COUNT = 64;
+
+    enum DataSlotState
+    {
+        DATA_SLOT_EMPTY,    // Value unknown, read from the table
+        DATA_SLOT_NIL,
+        DATA_SLOT_NUMBER,
+        DATA_SLOT_UINT64
+    };
+
+    struct DataSlot
+    {
+        DataSlot() : state(DATA_SLOT_EMPTY), pending(false), value(0) { }
+
+        uint8 state;
+        bool pending;
+        uint64 value;
+    };
+
+    mutable DataSlot dataSlots[DATA_SLOT_COUNT];
+    mutable std::mutex dataSlotsLock;
+    // Set while any slot is pending, read without the lock
+    std::atomic<bool> dataSlotsPending;
+
+    bool HasDataSlot(uint32 key) const;
+    bool GetDataSlot(uint32 key, uint64& value) const;
+    bool SetDataSlot(uint32 key, DataSlotState state, uint64 value);
+    // Caches the value at `index` of the table that was read for `key`
+    void FillDataSlot(uint32 key, lua_State* L, int index) const;
 
 public:
+    enum SaveFormat
+    {
+        SAVE_FORMAT_BASE64,             // Text, the format used by older versions
+        SAVE_FORMAT_BINARY,             // Needs a BLOB `data` column, see `Eluna::Initialize`
+        SAVE_FORMAT_BINARY_COMPRESSED,
+        SAVE_FORMAT_MAX
+    };
+
+    // Format `Save` writes, set from `Eluna.InstanceSaveFormat`. Load reads all formats.
+    static SaveFormat saveFormat;
+    // Whether `Save` marshals the data in the compact format, set from `Eluna.InstanceSaveCompact`
+    static bool saveCompact;
+
 #ifdef TRINITY
-    ElunaInstanceAI(Map* map) : InstanceData(map->ToInstanceMap())
+    ElunaInstanceAI(Map* map) : InstanceData(map->ToInstanceMap()), snapshotQueued(false), snapshotEncounters(0), dataSlotsPending(false)
     {
     }
 #else
-    ElunaInstanceAI(Map* map) : InstanceData(map)
+    ElunaInstanceAI(Map* map) : InstanceData(map), snapshotQueued(false), snapshotEncounters(0), dataSlotsPending(false)
     {
     }
 #endif
@@ -101,14 +171,22 @@ public:
 
     /*
      * Calls `Load` with the last save data that was passed to
-     * or from Eluna.
+     * or from Eluna, or loads the last marshalled data if it's known.
      *
      * See: big documentation blurb at the top of this class.
      */
-    void Reload()
-    {
-        Load(NULL);
-    }
+    void Reload();
+
+    // Encodes marshalled instance data in the format set by `Eluna.InstanceSaveFormat`
+    static void EncodeSaveData(const std::string& data, std::string& output);
+
+    /*
+     * Writes the pending data slots to the instance data table at `index`.
+     * Returns `true` if anything was written. Needs the Eluna lock.
+     */
+    bool FlushDataSlots(lua_State* L, int index);
+    // Empties all slots that are not pending, after the table was replaced or passed to Lua
+    void ResetDataSlots();
 
     /*
      * These methods allow non-Lua scripts (e.g. DB, C++) to get/set instance data.
@@ -0,0 +1,132 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaInstanceSaver.h"
+#include "ElunaInstanceAI.h"
+#include "ElunaIncludes.h"
+#include <algorithm>
+#include <sstream>
+
+ElunaInstanceSaver::ElunaInstanceSaver() : enabled(false), writing(false), writingId(0), stopping(false)
+{
+#if defined TRINITY || AZEROTHCORE
+    if (eConfigMgr->GetBoolDefault("Eluna.InstanceSaveAsync", false))
+    {
+        enabled = true;
+        thread = std::thread(&ElunaInstanceSaver::SaverThread, this);
+    }
+#endif
+}
+
+ElunaInstanceSaver::~ElunaInstanceSaver()
+{
+    Stop();
+}
+
+void ElunaInstanceSaver::Stop()
+{
+    if (!thread.joinable())
+        return;
+
+    enabled = false;
+    {
+        Guard guard(queueLock);
+        stopping = true;
+    }
+    queueCondition.notify_one();
+
+    // The thread writes everything still queued before it exits
+    thread.join();
+}
+
+void ElunaInstanceSaver::Queue(uint32 instanceId, uint32 completedEncounters, const std::string& data)
+{
+    {
+        Guard guard(queueLock);
+        // A save that saw the saver enabled just before `Stop`
+        if (stopping)
+        {
+            Save save;
+            save.completedEncounters = completedEncounters;
+            save.data = data;
+            guard.unlock();
+            Write(instanceId, save);
+            return;
+        }
+
+        auto itr = pending.find(instanceId);
+        if (itr != pending.end())
+        {
+            itr->second.completedEncounters = completedEncounters;
+            itr->second.data = data;
+            return;
+        }
+
+        Save& save = pending[instanceId];
+        save.completedEncounters = completedEncounters;
+        save.data = data;
+        order.push_back(instanceId);
+    }
+    queueCondition.notify_one();
+}
+
+void ElunaInstanceSaver::Drop(uint32 instanceId)
+{
+    if (!thread.joinable())
+        return;
+
+    Guard guard(queueLock);
+    if (pending.erase(instanceId))
+        order.erase(std::remove(order.begin(), order.end(), instanceId), order.end());
+
+    idleCondition.wait(guard, [this, instanceId]() { return !writing || writingId != instanceId; });
+}
+
+void ElunaInstanceSaver::SaverThread()
+{
+    Guard guard(queueLock);
+    while (true)
+    {
+        queueCondition.wait(guard, [this]() { return stopping || !order.empty(); });
+        if (order.empty())
+            break;
+
+        uint32 instanceId = order.front();
+        order.pop_front();
+
+        auto itr = pending.find(instanceId);
+        Save save;
+        save.completedEncounters = itr->second.completedEncounters;
+        save.data.swap(itr->second.data);
+        pending.erase(itr);
+
+        writing = true;
+        writingId = instanceId;
+        guard.unlock();
+
+        Write(instanceId, save);
+
+        guard.lock();
+        writing = false;
+        idleCondition.notify_all();
+    }
+}
+
+void ElunaInstanceSaver::Write(uint32 instanceId, const Save& save)
+{
+#if defined TRINITY || AZEROTHCORE
+    std::string encoded;
+    ElunaInstanceAI::EncodeSaveData(save.data, encoded);
+    CharacterDatabase.EscapeString(encoded);
+
+    std::ostringstream ss;
+    ss << "UPDATE `instance` SET `completedEncounters` = " << save.completedEncounters << ", `data` = '" << encoded << "' WHERE `id` = " << instanceId;
+    CharacterDatabase.DirectExecute(ss.str().c_str());
+#else
+    (void)instanceId;
+    (void)save;
+#endif
+}
@@ -0,0 +1,86 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_INSTANCE_SAVER_H
+#define _ELUNA_INSTANCE_SAVER_H
+
+#include "Common.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/*
+ * Writes instance data to the `instance` table on a background thread.
+ *
+ * With the saver enabled `ElunaInstanceAI::Save` only marshals the instance data
+ *   under the Eluna lock and queues it here. Encoding, compression and the database
+ *   write happen on the saver thread, and the core skips its own write.
+ * The saver writes the completed encounters along with the data, as the core would.
+ *
+ * Saves are written in the order they were queued. Queuing an instance that
+ *   already has a save waiting replaces the data of that save, so an instance
+ *   is never written with older data after newer data.
+ * `Stop` writes the saves still queued and ends the thread. It's called from the
+ *   world shutdown hook, while the character database is still open, and when the
+ *   saver is destroyed. After that `Save` hands the data to the core again.
+ *
+ * Enabled with `Eluna.InstanceSaveAsync`, only on TrinityCore and AzerothCore.
+ */
+class ElunaInstanceSaver
+{
+public:
+    ElunaInstanceSaver();
+    ~ElunaInstanceSaver();
+
+    // Queues the marshalled instance data `data` and the completed encounters of `instanceId` to be written
+    void Queue(uint32 instanceId, uint32 completedEncounters, const std::string& data);
+    // Writes all queued saves and stops the saver thread, saves queued after are written at once
+    void Stop();
+    // Forgets the queued save of `instanceId` and waits for a write of it in progress,
+    //   so nothing is written to the row of a new instance that reuses the ID
+    void Drop(uint32 instanceId);
+
+    bool IsEnabled() const { return enabled; }
+
+private:
+    typedef std::mutex LockType;
+    typedef std::unique_lock<LockType> Guard;
+
+    struct Save
+    {
+        uint32 completedEncounters;
+        std::string data;
+    };
+
+    void SaverThread();
+    static void Write(uint32 instanceId, const Save& save);
+
+    std::thread thread;
+    // Set while the thread runs, cleared once `Stop` is called
+    std::atomic<bool> enabled;
+
+    // Instance IDs in the order they were queued, each ID is in `pending` once
+    std::deque<uint32> order;
+    std::unordered_map<uint32, Save> pending;
+    LockType queueLock;
+    std::condition_variable queueCondition;
+    // Signalled whenever a write is done
+    std::condition_variable idleCondition;
+    bool writing;
+    // Instance being written while `writing` is set
+    uint32 writingId;
+    bool stopping;
+
+    // Prevent copy
+    ElunaInstanceSaver(ElunaInstanceSaver const&) = delete;
+    ElunaInstanceSaver& operator=(const ElunaInstanceSaver&) = delete;
+};
+
+#endif
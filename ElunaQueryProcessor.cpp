@@ -0,0 +1,218 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaQueryProcessor.h"
+#include "ElunaStatement.h"
+#include "LuaEngine.h"
+#include "ElunaIncludes.h"
+#if defined TRINITY || defined AZEROTHCORE
+#include "DatabaseEnv.h"
+#else
+#include "Database/DatabaseEnv.h"
+#include "Database/DatabaseImpl.h"
+#endif
+
+extern "C"
+{
+#include "lua.h"
+};
+
+#if defined TRINITY || defined AZEROTHCORE
+template<class T>
+static SQLTransaction<T> BuildTransaction(DatabaseWorkerPool<T>& database, ElunaTransaction const* transaction)
+{
+    SQLTransaction<T> trans = database.BeginTransaction();
+    for (std::vector<std::string>::const_iterator it = transaction->GetStatements().begin(); it != transaction->GetStatements().end(); ++it)
+        trans->Append(it->c_str());
+    return trans;
+}
+#endif
+
+ElunaQueryProcessor::ElunaQueryProcessor(Eluna* _E) : E(_E), generation(0), inFlight(0), completed(0)
+{
+}
+
+bool ElunaQueryProcessor::Query(ElunaDatabase db, const char* sql, int callbackRef)
+{
+    uint32 queryGeneration = generation;
+
+#if defined TRINITY || defined AZEROTHCORE
+    auto handler = [this, callbackRef, queryGeneration](QueryResult result)
+    {
+        Complete(callbackRef, queryGeneration, result ? new ElunaQuery(result) : NULL);
+    };
+
+    switch (db)
+    {
+        case ELUNA_DB_WORLD:
+            processor.AddCallback(WorldDatabase.AsyncQuery(sql).WithCallback(handler));
+            break;
+        case ELUNA_DB_CHARACTER:
+            processor.AddCallback(CharacterDatabase.AsyncQuery(sql).WithCallback(handler));
+            break;
+        case ELUNA_DB_AUTH:
+            processor.AddCallback(LoginDatabase.AsyncQuery(sql).WithCallback(handler));
+            break;
+        default:
+            return false;
+    }
+#else
+    Database* database;
+    switch (db)
+    {
+        case ELUNA_DB_WORLD:
+            database = &WorldDatabase;
+            break;
+        case ELUNA_DB_CHARACTER:
+            database = &CharacterDatabase;
+            break;
+        case ELUNA_DB_AUTH:
+            database = &LoginDatabase;
+            break;
+        default:
+            return false;
+    }
+
+    ElunaAsyncQuery* query = new ElunaAsyncQuery(callbackRef, queryGeneration);
+    if (!database->AsyncQuery(&ElunaQueryProcessor::QueryCallback, query, sql))
+    {
+        delete query;
+        return false;
+    }
+#endif
+
+    ++inFlight;
+    return true;
+}
+
+bool ElunaQueryProcessor::CommitTransaction(ElunaTransaction const* transaction, int callbackRef)
+{
+    uint32 queryGeneration = generation;
+
+#if defined TRINITY || defined AZEROTHCORE
+    auto handler = [this, callbackRef, queryGeneration](bool success)
+    {
+        CompleteTransaction(callbackRef, queryGeneration, success);
+    };
+
+    switch (transaction->GetDatabase())
+    {
+        case ELUNA_DB_WORLD:
+            transactionProcessor.AddCallback(WorldDatabase.AsyncCommitTransaction(BuildTransaction(WorldDatabase, transaction)).AfterComplete(handler));
+            break;
+        case ELUNA_DB_CHARACTER:
+            transactionProcessor.AddCallback(CharacterDatabase.AsyncCommitTransaction(BuildTransaction(CharacterDatabase, transaction)).AfterComplete(handler));
+            break;
+        case ELUNA_DB_AUTH:
+            transactionProcessor.AddCallback(LoginDatabase.AsyncCommitTransaction(BuildTransaction(LoginDatabase, transaction)).AfterComplete(handler));
+            break;
+        default:
+            return false;
+    }
+    return true;
+#else
+    Database* database;
+    switch (transaction->GetDatabase())
+    {
+        case ELUNA_DB_WORLD:
+            database = &WorldDatabase;
+            break;
+        case ELUNA_DB_CHARACTER:
+            database = &CharacterDatabase;
+            break;
+        case ELUNA_DB_AUTH:
+            database = &LoginDatabase;
+            break;
+        default:
+            return false;
+    }
+
+    // Statements executed between begin and commit are collected by the core and sent as one transaction
+    database->BeginTransaction();
+    for (std::vector<std::string>::const_iterator it = transaction->GetStatements().begin(); it != transaction->GetStatements().end(); ++it)
+        database->Execute(it->c_str());
+    bool success = database->CommitTransaction();
+
+    if (callbackRef != LUA_NOREF)
+        commits.push_back(std::make_pair(callbackRef, success));
+    return success;
+#endif
+}
+
+#if !defined TRINITY && !defined AZEROTHCORE
+void ElunaQueryProcessor::QueryCallback(QueryResult* result, ElunaAsyncQuery* query)
+{
+    // The core may hand back results after Eluna was shut down
+    if (!Eluna::IsInitialized() || !sEluna)
+    {
+        delete result;
+        delete query;
+        return;
+    }
+
+    // Results are kept until the next world update so callbacks always run from the same place
+    query->result = result;
+    sEluna->queryProcessor->results.Enqueue(query);
+}
+#endif
+
+void ElunaQueryProcessor::Update()
+{
+#if defined TRINITY || defined AZEROTHCORE
+    processor.ProcessReadyCallbacks();
+    transactionProcessor.ProcessReadyCallbacks();
+#else
+    ElunaAsyncQuery* query;
+    while (results.Dequeue(query))
+    {
+        // Rows fetched asynchronously have no column names
+        ElunaQuery* result = query->result ? new ElunaQuery(query->result, QueryFieldNames()) : NULL;
+        Complete(query->callbackRef, query->generation, result);
+        delete query;
+    }
+
+    // Callbacks can commit new transactions, so take the current batch first
+    std::vector<std::pair<int, bool> > committed;
+    committed.swap(commits);
+    for (std::vector<std::pair<int, bool> >::const_iterator it = committed.begin(); it != committed.end(); ++it)
+        CompleteTransaction(it->first, generation, it->second);
+#endif
+}
+
+void ElunaQueryProcessor::ClearCallbacks()
+{
+    ++generation;
+#if !defined TRINITY && !defined AZEROTHCORE
+    commits.clear();
+#endif
+}
+
+void ElunaQueryProcessor::Complete(int callbackRef, uint32 queryGeneration, ElunaQuery* result)
+{
+    --inFlight;
+    ++completed;
+
+    // Callback refs of older generations died with the previous Lua state
+    if (queryGeneration != generation || !E->HasLuaState())
+    {
+        delete result;
+        return;
+    }
+
+    E->OnQueryResult(callbackRef, result);
+}
+
+void ElunaQueryProcessor::CompleteTransaction(int callbackRef, uint32 queryGeneration, bool success)
+{
+    if (callbackRef == LUA_NOREF)
+        return;
+
+    // Callback refs of older generations died with the previous Lua state
+    if (queryGeneration != generation || !E->HasLuaState())
+        return;
+
+    E->OnTransactionResult(callbackRef, success);
+}
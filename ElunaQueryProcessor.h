@@ -0,0 +1,101 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_QUERY_PROCESSOR_H
+#define _ELUNA_QUERY_PROCESSOR_H
+
+#include "ElunaUtility.h"
+#include "Common.h"
+#include <atomic>
+#include <vector>
+#if defined TRINITY || defined AZEROTHCORE
+#include "DatabaseEnvFwd.h"
+#include "AsyncCallbackProcessor.h"
+#include "QueryCallback.h"
+#include "Transaction.h"
+#endif
+
+class Eluna;
+class ElunaTransaction;
+
+enum ElunaDatabase
+{
+    ELUNA_DB_WORLD,
+    ELUNA_DB_CHARACTER,
+    ELUNA_DB_AUTH,
+};
+
+#if !defined TRINITY && !defined AZEROTHCORE
+/*
+ * A query handed to the core's async query thread, completed when the core
+ *   passes the result back to `ElunaQueryProcessor::QueryCallback`.
+ */
+struct ElunaAsyncQuery
+{
+    ElunaAsyncQuery(int _callbackRef, uint32 _generation) : callbackRef(_callbackRef), generation(_generation), result(NULL) { }
+
+    int callbackRef;
+    uint32 generation;
+    QueryResult* result;
+};
+#endif
+
+/*
+ * Runs database queries on the core's async query threads and calls
+ *   the Lua callbacks with the results on world update.
+ */
+class ElunaQueryProcessor
+{
+public:
+    ElunaQueryProcessor(Eluna* _E);
+
+    // Queues `sql` on `db`. Returns false if the core refused the query.
+    bool Query(ElunaDatabase db, const char* sql, int callbackRef);
+    // Calls the callbacks of completed queries, should only be called by the owning state.
+    void Update();
+    /*
+     * Commits the statements of `transaction` as one transaction on its database.
+     *
+     * `callbackRef` may be LUA_NOREF. Otherwise it is called on world update
+     *   once the commit completes, or right after it was handed to the core
+     *   on cores that do not report commit completion.
+     */
+    bool CommitTransaction(ElunaTransaction const* transaction, int callbackRef);
+    // Forgets the callbacks of queries in flight, used when the Lua state is closed.
+    void ClearCallbacks();
+
+    uint32 GetInFlight() const { return inFlight.load(std::memory_order_relaxed); }
+    uint64 GetCompleted() const { return completed.load(std::memory_order_relaxed); }
+
+private:
+#if defined TRINITY || defined AZEROTHCORE
+    QueryCallbackProcessor processor;
+    AsyncCallbackProcessor<TransactionCallback> transactionProcessor;
+#else
+    static void QueryCallback(QueryResult* result, ElunaAsyncQuery* query);
+
+    ElunaUtil::MPSCQueue<ElunaAsyncQuery> results;
+    // Callback refs and results of transactions handed to the core since the last update
+    std::vector<std::pair<int, bool> > commits;
+#endif
+
+    void Complete(int callbackRef, uint32 queryGeneration, ElunaQuery* result);
+    void CompleteTransaction(int callbackRef, uint32 queryGeneration, bool success);
+
+    Eluna* E;
+
+    // Callbacks of queries sent before the last ClearCallbacks are dropped
+    uint32 generation;
+
+    std::atomic<uint32> inFlight;
+    std::atomic<uint64> completed;
+
+    // Prevent copy
+    ElunaQueryProcessor(ElunaQueryProcessor const&) = delete;
+    ElunaQueryProcessor& operator=(const ElunaQueryProcessor&) = delete;
+};
+
+#endif
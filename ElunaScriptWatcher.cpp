@@ -0,0 +1,148 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaScriptWatcher.h"
+#include "ElunaIncludes.h"
+#include "ElunaUtility.h"
+#include <chrono>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+ElunaScriptWatcher::ElunaScriptWatcher() : fd(-1), delay(0), stopping(false), changed(false)
+{
+    if (!eConfigMgr->GetBoolDefault("Eluna.ScriptWatcher", false))
+        return;
+
+#ifdef __linux__
+    delay = eConfigMgr->GetIntDefault("Eluna.ScriptWatcherDelay", 1000);
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd == -1)
+    {
+        ELUNA_LOG_ERROR("[Eluna]: Unable to start the script watcher, inotify_init1 failed");
+        return;
+    }
+
+    thread = std::thread(&ElunaScriptWatcher::WatcherThread, this);
+#else
+    ELUNA_LOG_ERROR("[Eluna]: The script watcher is only supported on Linux");
+#endif
+}
+
+ElunaScriptWatcher::~ElunaScriptWatcher()
+{
+    if (!IsEnabled())
+        return;
+
+    stopping = true;
+    thread.join();
+
+#ifdef __linux__
+    close(fd);
+#endif
+}
+
+void ElunaScriptWatcher::Watch(const std::vector<std::string>& folders)
+{
+    if (!IsEnabled())
+        return;
+
+#ifdef __linux__
+    for (std::vector<int>::const_iterator it = watches.begin(); it != watches.end(); ++it)
+        inotify_rm_watch(fd, *it);
+    watches.clear();
+
+    const uint32 mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    for (std::vector<std::string>::const_iterator it = folders.begin(); it != folders.end(); ++it)
+    {
+        int wd = inotify_add_watch(fd, it->c_str(), mask);
+        if (wd == -1)
+        {
+            ELUNA_LOG_ERROR("[Eluna]: Script watcher is unable to watch `%s`", it->c_str());
+            continue;
+        }
+        watches.push_back(wd);
+    }
+
+    ELUNA_LOG_DEBUG("[Eluna]: Script watcher is watching %u folders", uint32(watches.size()));
+#else
+    (void)folders;
+#endif
+}
+
+#ifdef __linux__
+// Scripts and folders count, editor swap files and hidden files such as the bytecode cache do not.
+// Dropped events may have been anything, so an overflowed queue counts too.
+static bool IsScriptEvent(const struct inotify_event* event)
+{
+    if (event->mask & IN_Q_OVERFLOW)
+        return true;
+    if (!event->len)
+        return (event->mask & IN_DELETE_SELF) != 0;
+
+    std::string name = event->name;
+    if (name[0] == '.')
+        return false;
+    if (event->mask & IN_ISDIR)
+        return true;
+
+    std::string::size_type extDot = name.find_last_of('.');
+    if (extDot == std::string::npos)
+        return false;
+
+    std::string ext = name.substr(extDot);
+    return ext == ".lua" || ext == ".dll" || ext == ".so" || ext == ".ext";
+}
+#endif
+
+void ElunaScriptWatcher::WatcherThread()
+{
+#ifdef __linux__
+    typedef std::chrono::steady_clock Clock;
+
+    bool pending = false;
+    Clock::time_point lastChange;
+
+    // Aligned for struct inotify_event
+    alignas(struct inotify_event) char buffer[4096];
+
+    while (!stopping)
+    {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if (poll(&pfd, 1, 100) > 0 && (pfd.revents & POLLIN))
+        {
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* ptr = buffer; ptr < buffer + length;)
+                {
+                    const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(ptr);
+                    if (IsScriptEvent(event))
+                    {
+                        pending = true;
+                        lastChange = Clock::now();
+                    }
+                    ptr += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+
+        if (pending && Clock::now() - lastChange >= std::chrono::milliseconds(delay))
+        {
+            pending = false;
+            changed = true;
+        }
+    }
+#endif
+}
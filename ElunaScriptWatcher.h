@@ -0,0 +1,55 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_SCRIPT_WATCHER_H
+#define _ELUNA_SCRIPT_WATCHER_H
+
+#include "Common.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Watches the script folders with inotify and reports when scripts were
+ *   added, changed or removed.
+ *
+ * Changes are debounced: they are reported once no further change was seen
+ *   for `Eluna.ScriptWatcherDelay` milliseconds, so saving many files at once
+ *   results in a single reload.
+ *
+ * Enabled with `Eluna.ScriptWatcher`. Only supported on Linux, elsewhere
+ *   no changes are ever reported.
+ */
+class ElunaScriptWatcher
+{
+public:
+    ElunaScriptWatcher();
+    ~ElunaScriptWatcher();
+
+    // Replaces the watched folders, should be called after the script folders were searched
+    void Watch(const std::vector<std::string>& folders);
+    // Returns true once after scripts changed
+    bool ConsumeChanges() { return changed.exchange(false); }
+
+    bool IsEnabled() const { return fd != -1; }
+
+private:
+    void WatcherThread();
+
+    int fd;
+    uint32 delay;
+    std::vector<int> watches;
+    std::thread thread;
+    std::atomic<bool> stopping;
+    std::atomic<bool> changed;
+
+    // Prevent copy
+    ElunaScriptWatcher(ElunaScriptWatcher const&) = delete;
+    ElunaScriptWatcher& operator=(const ElunaScriptWatcher&) = delete;
+};
+
+#endif
@@ -0,0 +1,317 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaStatement.h"
+#include "LuaEngine.h"
+#include "ElunaIncludes.h"
+#include "ElunaTemplate.h"
+#if defined TRINITY || defined AZEROTHCORE
+#include "DatabaseEnv.h"
+#else
+#include "Database/DatabaseEnv.h"
+#endif
+#include <cmath>
+#include <cstdio>
+
+extern "C"
+{
+#include "lua.h"
+#include "lauxlib.h"
+};
+
+ElunaSqlTemplate::ElunaSqlTemplate(ElunaDatabase _db, const std::string& _sql) : db(_db), sql(_sql)
+{
+    // Split at every ? that is not inside a quoted string or identifier
+    std::string fragment;
+    char quote = 0;
+    for (std::string::size_type i = 0; i < sql.size(); ++i)
+    {
+        char c = sql[i];
+        if (quote)
+        {
+            fragment += c;
+            if (c == '\\' && quote != '`' && i + 1 < sql.size())
+                fragment += sql[++i];
+            else if (c == quote)
+                quote = 0;
+        }
+        else if (c == '?')
+        {
+            fragments.push_back(fragment);
+            fragment.clear();
+        }
+        else
+        {
+            if (c == '\'' || c == '"' || c == '`')
+                quote = c;
+            fragment += c;
+        }
+    }
+    fragments.push_back(fragment);
+}
+
+std::string ElunaSqlTemplate::Render(const std::vector<std::string>& params) const
+{
+    ASSERT(params.size() == fragments.size() - 1);
+
+    std::string::size_type length = 0;
+    for (std::vector<std::string>::const_iterator it = fragments.begin(); it != fragments.end(); ++it)
+        length += it->size();
+    for (std::vector<std::string>::const_iterator it = params.begin(); it != params.end(); ++it)
+        length += it->size();
+
+    std::string output;
+    output.reserve(length);
+    output += fragments[0];
+    for (std::vector<std::string>::size_type i = 0; i < params.size(); ++i)
+    {
+        output += params[i];
+        output += fragments[i + 1];
+    }
+    return output;
+}
+
+ElunaSqlTemplateCache::EntryList ElunaSqlTemplateCache::entries;
+std::unordered_map<std::string, ElunaSqlTemplateCache::EntryList::iterator> ElunaSqlTemplateCache::index;
+std::mutex ElunaSqlTemplateCache::lock;
+uint64 ElunaSqlTemplateCache::hits = 0;
+uint64 ElunaSqlTemplateCache::misses = 0;
+uint32 ElunaSqlTemplateCache::capacity = 128;
+
+std::string ElunaSqlTemplateCache::MakeKey(ElunaDatabase db, const std::string& sql)
+{
+    std::string key(1, char('0' + db));
+    key += sql;
+    return key;
+}
+
+ElunaSqlTemplatePtr ElunaSqlTemplateCache::Get(ElunaDatabase db, const std::string& sql)
+{
+    std::string key = MakeKey(db, sql);
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = index.find(key);
+    if (it != index.end())
+    {
+        ++hits;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    ++misses;
+    ElunaSqlTemplatePtr sqlTemplate = std::make_shared<ElunaSqlTemplate const>(db, sql);
+
+    if (!capacity)
+        return sqlTemplate;
+
+    while (entries.size() >= capacity)
+    {
+        index.erase(entries.back().first);
+        entries.pop_back();
+    }
+
+    entries.push_front(Entry(key, sqlTemplate));
+    index[key] = entries.begin();
+    return sqlTemplate;
+}
+
+uint32 ElunaSqlTemplateCache::GetSize()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return uint32(entries.size());
+}
+
+uint64 ElunaSqlTemplateCache::GetHits()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return hits;
+}
+
+uint64 ElunaSqlTemplateCache::GetMisses()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return misses;
+}
+
+ElunaStatement::ElunaStatement(ElunaSqlTemplatePtr _sqlTemplate) : sqlTemplate(_sqlTemplate),
+    params(_sqlTemplate->GetParamCount()), bound(_sqlTemplate->GetParamCount(), false)
+{
+}
+
+bool ElunaStatement::Bind(uint32 index, const std::string& literal)
+{
+    if (index >= params.size())
+        return false;
+
+    params[index] = literal;
+    bound[index] = true;
+    return true;
+}
+
+void ElunaStatement::ClearParams()
+{
+    for (std::vector<std::string>::size_type i = 0; i < params.size(); ++i)
+    {
+        params[i].clear();
+        bound[i] = false;
+    }
+}
+
+uint32 ElunaStatement::GetUnboundParam() const
+{
+    for (std::vector<bool>::size_type i = 0; i < bound.size(); ++i)
+        if (!bound[i])
+            return uint32(i);
+    return uint32(bound.size());
+}
+
+ElunaQuery* ElunaStatement::Query() const
+{
+    return Query(GetDatabase(), Render());
+}
+
+void ElunaStatement::Execute() const
+{
+    Execute(GetDatabase(), Render());
+}
+
+bool ElunaStatement::ToLiteral(lua_State* L, int index, ElunaDatabase db, std::string& literal)
+{
+    char buf[32];
+    switch (lua_type(L, index))
+    {
+        case LUA_TNIL:
+        case LUA_TNONE:
+            literal = "NULL";
+            return true;
+        case LUA_TBOOLEAN:
+            literal = lua_toboolean(L, index) ? "1" : "0";
+            return true;
+        case LUA_TNUMBER:
+        {
+#if LUA_VERSION_NUM >= 503
+            // Integers are exact up to 64 bits, only floats go through a double
+            if (lua_isinteger(L, index))
+            {
+                snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(lua_tointeger(L, index)));
+                literal = buf;
+                return true;
+            }
+#endif
+            double value = lua_tonumber(L, index);
+            if (value != value || std::isinf(value))
+                return false;
+
+            // Whole numbers are sent as integers so they compare exactly with integer columns
+            if (value == std::floor(value) && std::fabs(value) < 9007199254740992.0)
+                snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(value));
+            else
+                snprintf(buf, sizeof(buf), "%.17g", value);
+            literal = buf;
+            return true;
+        }
+        case LUA_TSTRING:
+        {
+            size_t len;
+            const char* str = lua_tolstring(L, index, &len);
+            std::string escaped(str, len);
+            EscapeString(db, escaped);
+            literal = "'" + escaped + "'";
+            return true;
+        }
+        case LUA_TUSERDATA:
+            if (long long* value = Eluna::CHECKOBJ<long long>(L, index, false))
+            {
+                snprintf(buf, sizeof(buf), "%lld", *value);
+                literal = buf;
+                return true;
+            }
+            if (unsigned long long* value = Eluna::CHECKOBJ<unsigned long long>(L, index, false))
+            {
+                snprintf(buf, sizeof(buf), "%llu", *value);
+                literal = buf;
+                return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+void ElunaStatement::EscapeString(ElunaDatabase db, std::string& str)
+{
+    switch (db)
+    {
+#if defined TRINITY || defined AZEROTHCORE
+        case ELUNA_DB_WORLD:
+            WorldDatabase.EscapeString(str);
+            break;
+        case ELUNA_DB_CHARACTER:
+            CharacterDatabase.EscapeString(str);
+            break;
+        case ELUNA_DB_AUTH:
+            LoginDatabase.EscapeString(str);
+            break;
+#else
+        case ELUNA_DB_WORLD:
+            WorldDatabase.escape_string(str);
+            break;
+        case ELUNA_DB_CHARACTER:
+            CharacterDatabase.escape_string(str);
+            break;
+        case ELUNA_DB_AUTH:
+            LoginDatabase.escape_string(str);
+            break;
+#endif
+    }
+}
+
+ElunaQuery* ElunaStatement::Query(ElunaDatabase db, const std::string& sql)
+{
+#if defined TRINITY || defined AZEROTHCORE
+    QueryResult result;
+    switch (db)
+    {
+        case ELUNA_DB_WORLD:
+            result = WorldDatabase.Query(sql.c_str());
+            break;
+        case ELUNA_DB_CHARACTER:
+            result = CharacterDatabase.Query(sql.c_str());
+            break;
+        case ELUNA_DB_AUTH:
+            result = LoginDatabase.Query(sql.c_str());
+            break;
+    }
+    return result ? new ElunaQuery(result) : NULL;
+#else
+    switch (db)
+    {
+        case ELUNA_DB_WORLD:
+            return WorldDatabase.QueryNamed(sql.c_str());
+        case ELUNA_DB_CHARACTER:
+            return CharacterDatabase.QueryNamed(sql.c_str());
+        case ELUNA_DB_AUTH:
+            return LoginDatabase.QueryNamed(sql.c_str());
+    }
+    return NULL;
+#endif
+}
+
+void ElunaStatement::Execute(ElunaDatabase db, const std::string& sql)
+{
+    switch (db)
+    {
+        case ELUNA_DB_WORLD:
+            WorldDatabase.Execute(sql.c_str());
+            break;
+        case ELUNA_DB_CHARACTER:
+            CharacterDatabase.Execute(sql.c_str());
+            break;
+        case ELUNA_DB_AUTH:
+            LoginDatabase.Execute(sql.c_str());
+            break;
+    }
+}
@@ -0,0 +1,138 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_STATEMENT_H
+#define _ELUNA_STATEMENT_H
+
+#include "ElunaUtility.h"
+#include "ElunaQueryProcessor.h"
+#include "Common.h"
+#include <list>
+#include <string>
+#include <vector>
+
+struct lua_State;
+
+/*
+ * SQL text split at its `?` placeholders, parsed once and shared by every
+ *   statement created with the same text. Nothing is prepared on the
+ *   database server, the escaped parameters are rendered into the text.
+ */
+class ElunaSqlTemplate
+{
+public:
+    ElunaSqlTemplate(ElunaDatabase _db, const std::string& _sql);
+
+    ElunaDatabase GetDatabase() const { return db; }
+    const std::string& GetSql() const { return sql; }
+    uint32 GetParamCount() const { return uint32(fragments.size() - 1); }
+
+    // Joins the fragments with `params`, which must hold `GetParamCount` SQL literals
+    std::string Render(const std::vector<std::string>& params) const;
+
+private:
+    ElunaDatabase db;
+    std::string sql;
+    // Text around the placeholders, always one more than the amount of parameters
+    std::vector<std::string> fragments;
+};
+
+typedef std::shared_ptr<ElunaSqlTemplate const> ElunaSqlTemplatePtr;
+
+/*
+ * Least recently used cache of parsed SQL, keyed by database and SQL text.
+ *
+ * Holds at most `Eluna.SqlTemplateCacheSize` entries. Statements keep their
+ *   parsed SQL alive after it is evicted.
+ */
+class ElunaSqlTemplateCache
+{
+public:
+    static ElunaSqlTemplatePtr Get(ElunaDatabase db, const std::string& sql);
+
+    static uint32 GetSize();
+    static uint64 GetHits();
+    static uint64 GetMisses();
+
+    // Maximum amount of entries, 0 disables caching
+    static uint32 capacity;
+
+private:
+    typedef std::pair<std::string, ElunaSqlTemplatePtr> Entry;
+    typedef std::list<Entry> EntryList;
+
+    static std::string MakeKey(ElunaDatabase db, const std::string& sql);
+
+    // Most recently used first
+    static EntryList entries;
+    static std::unordered_map<std::string, EntryList::iterator> index;
+    static std::mutex lock;
+    static uint64 hits;
+    static uint64 misses;
+};
+
+/*
+ * A SQL template with its bound parameters, owned by Lua.
+ */
+class ElunaStatement
+{
+public:
+    ElunaStatement(ElunaSqlTemplatePtr _sqlTemplate);
+
+    ElunaDatabase GetDatabase() const { return sqlTemplate->GetDatabase(); }
+    const std::string& GetSql() const { return sqlTemplate->GetSql(); }
+    uint32 GetParamCount() const { return sqlTemplate->GetParamCount(); }
+
+    // `index` is 0 based. Returns false if the index is out of range.
+    bool Bind(uint32 index, const std::string& literal);
+    void ClearParams();
+    // Returns the index of the first unbound parameter or `GetParamCount` if all are bound
+    uint32 GetUnboundParam() const;
+    std::string Render() const { return sqlTemplate->Render(params); }
+
+    ElunaQuery* Query() const;
+    void Execute() const;
+
+    /*
+     * Converts the Lua value at `index` to a SQL literal for `db`.
+     *
+     * nil is NULL, booleans are 1 or 0, numbers and 64-bit integers keep their
+     *   value and strings are escaped and quoted.
+     * Returns false if the value has no SQL representation.
+     */
+    static bool ToLiteral(lua_State* L, int index, ElunaDatabase db, std::string& literal);
+    static void EscapeString(ElunaDatabase db, std::string& str);
+    static ElunaQuery* Query(ElunaDatabase db, const std::string& sql);
+    static void Execute(ElunaDatabase db, const std::string& sql);
+
+private:
+    ElunaSqlTemplatePtr sqlTemplate;
+    std::vector<std::string> params;
+    std::vector<bool> bound;
+};
+
+/*
+ * Statements collected in Lua to be committed as one transaction, owned by Lua.
+ */
+class ElunaTransaction
+{
+public:
+    ElunaTransaction(ElunaDatabase _db) : db(_db), committed(false) { }
+
+    ElunaDatabase GetDatabase() const { return db; }
+    void Append(const std::string& sql) { statements.push_back(sql); }
+    const std::vector<std::string>& GetStatements() const { return statements; }
+    uint32 GetStatementCount() const { return uint32(statements.size()); }
+    bool IsCommitted() const { return committed; }
+    void SetCommitted() { committed = true; }
+
+private:
+    ElunaDatabase db;
+    std::vector<std::string> statements;
+    bool committed;
+};
+
+#endif
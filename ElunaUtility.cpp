@@ -22,6 +22,8 @@
 #if defined MANGOS
 #include "Timer.h"
 #endif
+#include <algorithm>
+#include <zlib.h>
 
 uint32 ElunaUtil::GetCurrTime()
 {
@@ -127,6 +129,42 @@ bool ElunaUtil::WorldObjectInRangeCheck::operator()(WorldObject* u)
     return true;
 }
 
+ElunaUtil::WorldObjectNearestCollector::WorldObjectNearestCollector(WorldObjectInRangeCheck& check, uint32 count) :
+    i_check(check), i_count(count)
+{
+    i_heap.reserve(count < 64 ? count : 64);
+}
+bool ElunaUtil::WorldObjectNearestCollector::operator()(WorldObject* u)
+{
+    if (!i_count || !i_check(u))
+        return false;
+
+    float dist = i_check.i_obj->GetDistance(u);
+    if (i_heap.size() == i_count)
+    {
+        // Replace the farthest object
+        if (dist >= i_heap.front().first)
+            return false;
+        std::pop_heap(i_heap.begin(), i_heap.end());
+        i_heap.back() = Entry(dist, u);
+    }
+    else
+        i_heap.push_back(Entry(dist, u));
+    std::push_heap(i_heap.begin(), i_heap.end());
+
+    if (i_heap.size() == i_count)
+        i_check.i_range = i_heap.front().first;
+    return false;
+}
+void ElunaUtil::WorldObjectNearestCollector::GetObjects(std::vector<WorldObject*>& objects)
+{
+    std::sort_heap(i_heap.begin(), i_heap.end());
+
+    objects.reserve(i_heap.size());
+    for (std::vector<Entry>::const_iterator it = i_heap.begin(); it != i_heap.end(); ++it)
+        objects.push_back(it->second);
+}
+
 static char encoding_table[] = {'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
                                 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
                                 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
@@ -220,3 +258,115 @@ unsigned char* ElunaUtil::DecodeData(const char *data, size_t *output_length)
 
     return decoded_data;
 }
+
+/*
+ * Binary save format:
+ *
+ *   "\x1B" "ELD"   magic, the escape character can not start Base-64 data
+ *   version         one byte, BINARY_DATA_VERSION
+ *   flags           one byte, 'z' if the payload is zlib compressed, otherwise '-'
+ *   length          decimal length of the decoded data, terminated by ':'
+ *   payload         the rest, with 0x00 stored as 0x01 0x02 and 0x01 as 0x01 0x01
+ */
+static const char binary_magic[] = "\x1B" "ELD";
+static const size_t binary_magic_length = sizeof(binary_magic) - 1;
+static const char BINARY_DATA_VERSION = '1';
+static const char BINARY_ESCAPE = 0x01;
+
+// Data smaller than this is not worth compressing
+static const size_t BINARY_COMPRESS_MIN = 128;
+// The decoded length in the header is not trusted beyond these, zlib can not inflate data more than 1032 times
+static const unsigned long BINARY_DATA_MAX = 64 * 1024 * 1024;
+static const unsigned long BINARY_INFLATE_MAX_RATIO = 1032;
+
+void ElunaUtil::EncodeBinaryData(const unsigned char* data, size_t input_length, std::string& output, bool compress)
+{
+    std::vector<unsigned char> compressed;
+    const unsigned char* payload = data;
+    size_t payload_length = input_length;
+
+    if (compress && input_length >= BINARY_COMPRESS_MIN)
+    {
+        uLongf compressed_length = compressBound(input_length);
+        compressed.resize(compressed_length);
+        if (compress2(&compressed[0], &compressed_length, data, input_length, Z_BEST_SPEED) == Z_OK && compressed_length < input_length)
+        {
+            payload = &compressed[0];
+            payload_length = compressed_length;
+        }
+    }
+
+    char header[32];
+    int header_length = snprintf(header, sizeof(header), "%s%c%c%u:", binary_magic, BINARY_DATA_VERSION,
+        payload == data ? '-' : 'z', uint32(input_length));
+
+    output.clear();
+    output.reserve(header_length + payload_length + payload_length / 64 + 1);
+    output.append(header, header_length);
+
+    for (size_t i = 0; i < payload_length; ++i)
+    {
+        char byte = payload[i];
+        if (byte == '\0' || byte == BINARY_ESCAPE)
+        {
+            output.push_back(BINARY_ESCAPE);
+            byte = byte == '\0' ? 0x02 : 0x01;
+        }
+        output.push_back(byte);
+    }
+}
+
+bool ElunaUtil::IsBinaryData(const char* data)
+{
+    return strncmp(data, binary_magic, binary_magic_length) == 0;
+}
+
+bool ElunaUtil::DecodeBinaryData(const char* data, std::string& output)
+{
+    if (!IsBinaryData(data))
+        return false;
+    data += binary_magic_length;
+
+    if (data[0] != BINARY_DATA_VERSION || (data[1] != '-' && data[1] != 'z'))
+        return false;
+    bool compressed = data[1] == 'z';
+    data += 2;
+
+    char* end;
+    unsigned long length = strtoul(data, &end, 10);
+    if (end == data || *end != ':' || length > BINARY_DATA_MAX)
+        return false;
+    data = end + 1;
+
+    std::string payload;
+    payload.reserve(strlen(data));
+    for (; *data; ++data)
+    {
+        char byte = *data;
+        if (byte == BINARY_ESCAPE)
+        {
+            ++data;
+            if (*data != 0x01 && *data != 0x02)
+                return false;
+            byte = *data == 0x02 ? '\0' : BINARY_ESCAPE;
+        }
+        payload.push_back(byte);
+    }
+
+    if (!compressed)
+    {
+        if (payload.size() != length)
+            return false;
+        output.swap(payload);
+        return true;
+    }
+
+    if (length > payload.size() * BINARY_INFLATE_MAX_RATIO)
+        return false;
+
+    output.resize(length);
+    uLongf output_length = length;
+    if (length && uncompress((Bytef*)&output[0], &output_length, (const Bytef*)payload.data(), payload.size()) != Z_OK)
+        return false;
+    return output_length == length;
+}
@@ -9,8 +9,10 @@
 
 #include <unordered_map>
 #include <unordered_set>
+#include <atomic>
 #include <mutex>
 #include <memory>
+#include <vector>
 #include "Common.h"
 #ifndef CMANGOS
 #include "SharedDefines.h"
@@ -157,6 +159,64 @@ namespace ElunaUtil
         bool const i_nearest;
     };
 
+    /*
+     * Check for the core's searchers that stores the objects accepted by `check`
+     *   in `objects` and rejects all of them, so the searcher visits every object
+     *   in range and never keeps one itself. Used instead of the ListSearchers,
+     *   which collect into a std::list.
+     *
+     * With `maxCount` set the object that fills `objects` is accepted, so a Searcher,
+     *   which stops at the first accepted object, stops visiting the grid there.
+     */
+    class WorldObjectCollector
+    {
+    public:
+        WorldObjectCollector(WorldObjectInRangeCheck& check, std::vector<WorldObject*>& objects, uint32 maxCount = 0) :
+            i_check(check), i_objects(objects), i_maxCount(maxCount)
+        {
+            // Enough for most searches without growing
+            i_objects.reserve(maxCount && maxCount < 64 ? maxCount : 64);
+        }
+        WorldObject const& GetFocusObject() const { return i_check.GetFocusObject(); }
+        bool operator()(WorldObject* u)
+        {
+            if (i_maxCount && i_objects.size() >= i_maxCount)
+                return true;
+            if (i_check(u))
+                i_objects.push_back(u);
+            return i_maxCount && i_objects.size() >= i_maxCount;
+        }
+
+        WorldObjectInRangeCheck& i_check;
+        std::vector<WorldObject*>& i_objects;
+        // Objects after the first `i_maxCount` are skipped, 0 for no limit
+        uint32 const i_maxCount;
+    };
+
+    /*
+     * Check for the core's LastSearchers that keeps the `count` objects accepted by
+     *   `check` that are nearest to its focus object, in a max-heap on their distance.
+     *
+     * Once `count` objects were found the range of `check` shrinks to the distance
+     *   of the farthest of them, so objects further away fail the range check.
+     */
+    class WorldObjectNearestCollector
+    {
+    public:
+        WorldObjectNearestCollector(WorldObjectInRangeCheck& check, uint32 count);
+        WorldObject const& GetFocusObject() const { return i_check.GetFocusObject(); }
+        bool operator()(WorldObject* u);
+        // Stores the objects found in `objects`, nearest first
+        void GetObjects(std::vector<WorldObject*>& objects);
+
+    private:
+        typedef std::pair<float, WorldObject*> Entry;
+
+        WorldObjectInRangeCheck& i_check;
+        uint32 const i_count;
+        std::vector<Entry> i_heap;
+    };
+
     /*
      * Usage:
      * Inherit this class, then when needing lock, use
@@ -176,6 +236,69 @@ namespace ElunaUtil
         LockType _lock;
     };
 
+    /*
+     * Lock-free multiple producer, single consumer queue.
+     *
+     * Any thread can `Enqueue`, but only one thread at a time may `Dequeue`.
+     * The queue takes ownership of enqueued pointers and deletes any
+     *   that are still queued when it is destroyed.
+     *
+     * Based on Dmitry Vyukov's non-intrusive MPSC node-based queue.
+     */
+    template<typename T>
+    class MPSCQueue
+    {
+    public:
+        MPSCQueue() : _head(new Node()), _tail(_head.load(std::memory_order_relaxed))
+        {
+        }
+
+        ~MPSCQueue()
+        {
+            T* output;
+            while (Dequeue(output))
+                delete output;
+
+            delete _tail;
+        }
+
+        void Enqueue(T* input)
+        {
+            Node* node = new Node(input);
+            Node* prevHead = _head.exchange(node, std::memory_order_acq_rel);
+            prevHead->Next.store(node, std::memory_order_release);
+        }
+
+        bool Dequeue(T*& result)
+        {
+            Node* tail = _tail;
+            Node* next = tail->Next.load(std::memory_order_acquire);
+            if (!next)
+                return false;
+
+            result = next->Data;
+            _tail = next;
+            delete tail;
+            return true;
+        }
+
+    private:
+        struct Node
+        {
+            Node() : Data(nullptr), Next(nullptr) { }
+            explicit Node(T* data) : Data(data), Next(nullptr) { }
+
+            T* Data;
+            std::atomic<Node*> Next;
+        };
+
+        std::atomic<Node*> _head;
+        Node* _tail;
+
+        MPSCQueue(MPSCQueue const&) = delete;
+        MPSCQueue& operator=(MPSCQueue const&) = delete;
+    };
+
     /*
      * Encodes `data` in Base-64 and store the result in `output`.
      */
@@ -187,6 +310,31 @@ namespace ElunaUtil
      * The returned result buffer must be `delete[]`ed by the caller.
      */
     unsigned char* DecodeData(const char* data, size_t *output_length);
+
+    /*
+     * Encodes `data` in the binary save format and stores the result in `output`.
+     *
+     * The result starts with a header holding the format version, flags and the
+     *   length of `data`, followed by `data` itself, zlib compressed if `compress` is set
+     *   and compressing makes it smaller.
+     * NUL bytes are escaped so the result can be passed around as a C string
+     *   and written through string queries, but it is not text. It must be stored
+     *   in a BLOB column, a text column could change the bytes on the way.
+     */
+    void EncodeBinaryData(const unsigned char* data, size_t input_length, std::string& output, bool compress);
+
+    /*
+     * Returns true if `data` was made by `EncodeBinaryData`, otherwise it's Base-64.
+     */
+    bool IsBinaryData(const char* data);
+
+    /*
+     * Decodes `data` made by `EncodeBinaryData` into `output`.
+     *
+     * Returns false if the data is corrupt or of an unknown version, or if the
+     *   decoded length in its header is larger than the payload can hold.
+     */
+    bool DecodeBinaryData(const char* data, std::string& output);
 };
 
 #endif
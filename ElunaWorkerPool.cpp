@@ -0,0 +1,227 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#include "ElunaWorkerPool.h"
+#include "LuaEngine.h"
+#include "ElunaIncludes.h"
+#include "lmarshal.h"
+#include <chrono>
+
+extern "C"
+{
+#include "lua.h"
+#include "lualib.h"
+#include "lauxlib.h"
+#ifdef LUA_JITLIBNAME
+#include "luajit.h"
+#endif
+};
+
+#define ELUNA_WORKER_PTR "Eluna Worker Ptr"
+
+// Instructions a job runs between checks of its time limit
+#define JOB_HOOK_COUNT 10000
+
+ElunaWorkerPool::ElunaWorkerPool(Eluna* _E) : E(_E), stopping(false), generation(0), queueSize(0), timeLimit(0)
+{
+    uint32 workerCount = eConfigMgr->GetIntDefault("Eluna.AsyncWorkers", 2);
+    queueSize = eConfigMgr->GetIntDefault("Eluna.AsyncQueueSize", 1000);
+    timeLimit = eConfigMgr->GetIntDefault("Eluna.AsyncTimeLimit", 10000);
+
+    for (uint32 i = 0; i < workerCount; ++i)
+        workers.push_back(std::thread(&ElunaWorkerPool::WorkerThread, this));
+}
+
+ElunaWorkerPool::~ElunaWorkerPool()
+{
+    // Running jobs fail on their next hook call
+    {
+        Guard guard(jobLock);
+        stopping = true;
+    }
+    jobCondition.notify_all();
+
+    for (std::vector<std::thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+
+    for (JobQueue::iterator it = jobs.begin(); it != jobs.end(); ++it)
+        delete *it;
+}
+
+bool ElunaWorkerPool::Queue(int callbackRef, const std::string& data)
+{
+    if (workers.empty())
+        return false;
+
+    {
+        Guard guard(jobLock);
+        if (queueSize && jobs.size() >= queueSize)
+            return false;
+
+        jobs.push_back(new ElunaAsyncJob(callbackRef, generation.load(), data));
+    }
+    jobCondition.notify_one();
+    return true;
+}
+
+void ElunaWorkerPool::Update()
+{
+    ElunaAsyncResult* result;
+    while (results.Dequeue(result))
+    {
+        // Callback refs of older generations died with the previous Lua state
+        if (result->generation == generation.load() && E->HasLuaState())
+            E->OnAsyncResult(result->callbackRef, result->success, result->data);
+
+        delete result;
+    }
+}
+
+void ElunaWorkerPool::ClearJobs()
+{
+    Guard guard(jobLock);
+    ++generation;
+
+    for (JobQueue::iterator it = jobs.begin(); it != jobs.end(); ++it)
+        delete *it;
+    jobs.clear();
+}
+
+void ElunaWorkerPool::WorkerThread()
+{
+    lua_State* L = CreateWorkerState();
+
+    WorkerContext context;
+    context.pool = this;
+    lua_pushlightuserdata(L, &context);
+    lua_setfield(L, LUA_REGISTRYINDEX, ELUNA_WORKER_PTR);
+
+    while (true)
+    {
+        ElunaAsyncJob* job;
+        {
+            Guard guard(jobLock);
+            jobCondition.wait(guard, [this] { return stopping || !jobs.empty(); });
+            if (stopping)
+                break;
+
+            job = jobs.front();
+            jobs.pop_front();
+        }
+
+        if (timeLimit)
+            context.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeLimit);
+        // A job that ran out of time checks on every instruction, so it can't keep going
+        //   by catching the error with `pcall`
+        lua_sethook(L, &ElunaWorkerPool::JobHook, LUA_MASKCOUNT, JOB_HOOK_COUNT);
+
+        results.Enqueue(RunJob(L, job));
+        delete job;
+    }
+
+    lua_close(L);
+}
+
+lua_State* ElunaWorkerPool::CreateWorkerState()
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+
+#ifdef LUA_JITLIBNAME
+    // Compiled code does not call hooks, which stop jobs that run too long
+    luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+#endif
+
+    // No file, process or module access for workers
+    static const char* const removedGlobals[] = { "io", "package", "debug", "require", "module", "dofile", "loadfile", "jit", NULL };
+    for (const char* const* name = removedGlobals; *name; ++name)
+    {
+        lua_pushnil(L);
+        lua_setglobal(L, *name);
+    }
+
+    // Only keep the time functions of os
+    static const char* const removedOsFields[] = { "execute", "exit", "getenv", "remove", "rename", "setlocale", "tmpname", NULL };
+    lua_getglobal(L, "os");
+    for (const char* const* name = removedOsFields; *name; ++name)
+    {
+        lua_pushnil(L);
+        lua_setfield(L, -2, *name);
+    }
+    lua_pop(L, 1);
+
+    return L;
+}
+
+void ElunaWorkerPool::JobHook(lua_State* L, lua_Debug* /*ar*/)
+{
+    lua_getfield(L, LUA_REGISTRYINDEX, ELUNA_WORKER_PTR);
+    WorkerContext* context = static_cast<WorkerContext*>(lua_touserdata(L, -1));
+    lua_pop(L, 1);
+
+    if (context->pool->stopping)
+    {
+        lua_sethook(L, &ElunaWorkerPool::JobHook, LUA_MASKCOUNT, 1);
+        luaL_error(L, "the worker pool is stopping");
+    }
+    if (context->pool->timeLimit && std::chrono::steady_clock::now() > context->deadline)
+    {
+        lua_sethook(L, &ElunaWorkerPool::JobHook, LUA_MASKCOUNT, 1);
+        luaL_error(L, "the job ran longer than %d ms", int(context->pool->timeLimit));
+    }
+}
+
+ElunaAsyncResult* ElunaWorkerPool::RunJob(lua_State* L, ElunaAsyncJob* job)
+{
+    lua_settop(L, 0);
+
+    // Stack: call
+    lua_pushcfunction(L, mar_decode);
+    lua_pushlstring(L, job->data.c_str(), job->data.size());
+    if (lua_pcall(L, 1, 1, 0) || !lua_istable(L, 1))
+    {
+        std::string error = lua_isstring(L, -1) ? lua_tostring(L, -1) : "unable to decode the function call";
+        return new ElunaAsyncResult(job->callbackRef, job->generation, false, error);
+    }
+
+    lua_getfield(L, 1, "n");
+    int argc = int(lua_tointeger(L, -1));
+    lua_pop(L, 1);
+    if (argc < 0 || !lua_checkstack(L, argc + 1))
+        return new ElunaAsyncResult(job->callbackRef, job->generation, false, "too many arguments");
+
+    // Stack: call, function, [arguments]
+    for (int i = 1; i <= argc + 1; ++i)
+        lua_rawgeti(L, 1, i);
+
+    // Stack: call, [results or errmsg]
+    if (lua_pcall(L, argc, LUA_MULTRET, 0))
+    {
+        std::string error = lua_isstring(L, -1) ? lua_tostring(L, -1) : "unknown error";
+        return new ElunaAsyncResult(job->callbackRef, job->generation, false, error);
+    }
+
+    // Stack: call, [results], encode, packed
+    int resc = lua_gettop(L) - 1;
+    lua_pushcfunction(L, mar_encode);
+    lua_createtable(L, resc, 1);
+    for (int i = 1; i <= resc; ++i)
+    {
+        lua_pushvalue(L, i + 1);
+        lua_rawseti(L, -2, i);
+    }
+    lua_pushinteger(L, resc);
+    lua_setfield(L, -2, "n");
+
+    bool success = !lua_pcall(L, 1, 1, 0);
+    size_t len = 0;
+    const char* data = lua_tolstring(L, -1, &len);
+    std::string output = data ? std::string(data, len) : "unable to encode the returned values";
+
+    ElunaAsyncResult* result = new ElunaAsyncResult(job->callbackRef, job->generation, success, output);
+    lua_settop(L, 0);
+    return result;
+}
@@ -0,0 +1,126 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef _ELUNA_WORKER_POOL_H
+#define _ELUNA_WORKER_POOL_H
+
+#include "ElunaUtility.h"
+#include "Common.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Eluna;
+struct lua_State;
+struct lua_Debug;
+
+/*
+ * A function call to run on a worker, serialized with lmarshal as `{ n = argc, func, args... }`.
+ */
+struct ElunaAsyncJob
+{
+    ElunaAsyncJob(int _callbackRef, uint32 _generation, const std::string& _data) :
+        callbackRef(_callbackRef), generation(_generation), data(_data) { }
+
+    int callbackRef;
+    uint32 generation;
+    std::string data;
+};
+
+/*
+ * The outcome of an `ElunaAsyncJob`.
+ *
+ * On success `data` holds the return values serialized as `{ n = count, values... }`,
+ *   otherwise it holds the error message.
+ */
+struct ElunaAsyncResult
+{
+    ElunaAsyncResult(int _callbackRef, uint32 _generation, bool _success, const std::string& _data) :
+        callbackRef(_callbackRef), generation(_generation), success(_success), data(_data) { }
+
+    int callbackRef;
+    uint32 generation;
+    bool success;
+    std::string data;
+};
+
+/*
+ * Runs pure Lua functions on a pool of worker threads.
+ *
+ * Each worker owns a sandboxed Lua state with the standard libraries, minus
+ *   file, process and module access, and none of the game bindings.
+ * Functions and their arguments are copied to the worker with lmarshal, and
+ *   results are copied back and handed to the owning state on world update.
+ *
+ * Pool size and queue depth are read from `Eluna.AsyncWorkers` and `Eluna.AsyncQueueSize`.
+ *
+ * A job that runs longer than `Eluna.AsyncTimeLimit` milliseconds (0 for no limit) fails
+ *   with an error, and so does every running job once the pool is stopping, so a
+ *   function that never returns can't keep a worker or shutdown waiting. The check runs
+ *   in a count hook, which compiled LuaJIT code skips, so workers only run the interpreter.
+ */
+class ElunaWorkerPool
+{
+public:
+    typedef std::deque<ElunaAsyncJob*> JobQueue;
+
+    ElunaWorkerPool(Eluna* _E);
+    ~ElunaWorkerPool();
+
+    // Queues the serialized call `data`. Returns false if the pool is disabled or the queue is full.
+    bool Queue(int callbackRef, const std::string& data);
+    // Calls the callbacks of finished jobs, should only be called by the owning state.
+    void Update();
+    // Forgets queued jobs and results of running ones, used when the Lua state is closed.
+    void ClearJobs();
+
+    uint32 GetWorkerCount() const { return uint32(workers.size()); }
+
+private:
+    typedef std::mutex LockType;
+    typedef std::unique_lock<LockType> Guard;
+
+    // A worker thread, stored in the registry of its Lua state for `JobHook`
+    struct WorkerContext
+    {
+        ElunaWorkerPool* pool;
+        // When the running job fails, if the pool has a time limit
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void WorkerThread();
+    static lua_State* CreateWorkerState();
+    static ElunaAsyncResult* RunJob(lua_State* L, ElunaAsyncJob* job);
+    // Count hook of the worker states, fails the job when it ran too long or the pool is stopping
+    static void JobHook(lua_State* L, lua_Debug* ar);
+
+    Eluna* E;
+    std::vector<std::thread> workers;
+
+    JobQueue jobs;
+    LockType jobLock;
+    std::condition_variable jobCondition;
+    // Also read by `JobHook` without the lock
+    std::atomic<bool> stopping;
+
+    ElunaUtil::MPSCQueue<ElunaAsyncResult> results;
+
+    // Results of jobs queued before the last ClearJobs are dropped
+    std::atomic<uint32> generation;
+    uint32 queueSize;
+    // Milliseconds a job may run, 0 for no limit
+    uint32 timeLimit;
+
+    // Prevent copy
+    ElunaWorkerPool(ElunaWorkerPool const&) = delete;
+    ElunaWorkerPool& operator=(const ElunaWorkerPool&) = delete;
+};
+
+#endif
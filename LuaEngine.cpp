@@ -8,11 +8,22 @@
 #include "LuaEngine.h"
 #include "BindingMap.h"
 #include "ElunaEventMgr.h"
+#include "ElunaChannelMgr.h"
+#include "ElunaWorkerPool.h"
+#include "ElunaQueryProcessor.h"
+#include "ElunaStatement.h"
+#include "ElunaBytecodeCache.h"
+#include "ElunaScriptWatcher.h"
+#include "ElunaInstanceSaver.h"
 #include "ElunaIncludes.h"
 #include "ElunaTemplate.h"
 #include "ElunaUtility.h"
 #include "ElunaCreatureAI.h"
 #include "ElunaInstanceAI.h"
+#include "lmarshal.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 #if defined(TRINITY_PLATFORM) && defined(TRINITY_PLATFORM_WINDOWS)
 #if TRINITY_PLATFORM == TRINITY_PLATFORM_WINDOWS
@@ -62,9 +73,11 @@ extern "C"
 Eluna::ScriptList Eluna::lua_scripts;
 Eluna::ScriptList Eluna::lua_extensions;
 std::string Eluna::lua_folderpath;
+std::vector<std::string> Eluna::lua_scriptfolders;
 std::string Eluna::lua_requirepath;
 Eluna* Eluna::GEluna = NULL;
 bool Eluna::reload = false;
+bool Eluna::reloadChanged = false;
 bool Eluna::initialized = false;
 Eluna::LockType Eluna::lock;
 
@@ -75,10 +88,25 @@ void Eluna::Initialize()
     LOCK_ELUNA;
     ASSERT(!IsInitialized());
 
+    ElunaInstanceAI::saveCompact = eConfigMgr->GetBoolDefault("Eluna.InstanceSaveCompact", false);
+    ElunaSqlTemplateCache::capacity = eConfigMgr->GetIntDefault("Eluna.SqlTemplateCacheSize", 128);
+
 #if defined TRINITY || AZEROTHCORE
+    uint32 saveFormat = eConfigMgr->GetIntDefault("Eluna.InstanceSaveFormat", ElunaInstanceAI::SAVE_FORMAT_BASE64);
+    if (saveFormat >= ElunaInstanceAI::SAVE_FORMAT_MAX)
+    {
+        ELUNA_LOG_ERROR("[Eluna]: Unknown Eluna.InstanceSaveFormat %u, using Base-64", saveFormat);
+        saveFormat = ElunaInstanceAI::SAVE_FORMAT_BASE64;
+    }
+    ElunaInstanceAI::saveFormat = ElunaInstanceAI::SaveFormat(saveFormat);
+
     // For instance data the data column needs to be able to hold more than 255 characters (tinytext)
-    // so we change it to TEXT automatically on startup
-    CharacterDatabase.DirectExecute("ALTER TABLE `instance` CHANGE COLUMN `data` `data` TEXT NOT NULL");
+    // so we change it to TEXT automatically on startup, or to BLOB for the binary save format.
+    // Binary data is still written as an escaped string, only a BLOB column stores its bytes unchanged.
+    if (ElunaInstanceAI::saveFormat == ElunaInstanceAI::SAVE_FORMAT_BASE64)
+        CharacterDatabase.DirectExecute("ALTER TABLE `instance` CHANGE COLUMN `data` `data` TEXT NOT NULL");
+    else
+        CharacterDatabase.DirectExecute("ALTER TABLE `instance` CHANGE COLUMN `data` `data` BLOB NOT NULL");
 #endif
 
     LoadScriptPaths();
@@ -120,6 +148,7 @@ void Eluna::LoadScriptPaths()
 #endif
     ELUNA_LOG_INFO("[Eluna]: Searching scripts from `%s`", lua_folderpath.c_str());
     lua_requirepath.clear();
+    lua_scriptfolders.clear();
     GetScripts(lua_folderpath);
     // Erase last ;
     if (!lua_requirepath.empty())
@@ -135,6 +164,16 @@ void Eluna::_ReloadEluna()
 
     eWorld->SendServerMessage(SERVER_MSG_STRING, "Reloading Eluna...");
 
+    bool incremental = reloadChanged || eConfigMgr->GetIntDefault("Eluna.ReloadMode", ELUNA_RELOAD_FULL) == ELUNA_RELOAD_INCREMENTAL;
+    reloadChanged = false;
+
+    if (incremental && sEluna->ReloadModules())
+    {
+        sEluna->scriptWatcher->Watch(lua_scriptfolders);
+        reload = false;
+        return;
+    }
+
     // Remove all timed events
     sEluna->eventMgr->SetStates(LUAEVENT_STATE_ERASE);
 
@@ -150,6 +189,9 @@ void Eluna::_ReloadEluna()
     // Run scripts from laoded paths
     sEluna->RunScripts();
 
+    // Folders may have been added or removed
+    sEluna->scriptWatcher->Watch(lua_scriptfolders);
+
     reload = false;
 }
 
@@ -157,9 +199,18 @@ Eluna::Eluna() :
 event_level(0),
 push_counter(0),
 enabled(false),
+instanceDataCreated(0),
+instanceDataFreed(0),
+loadingModule(NULL),
+lastModuleId(0),
 
 L(NULL),
 eventMgr(NULL),
+channelMgr(NULL),
+workerPool(NULL),
+queryProcessor(NULL),
+scriptWatcher(NULL),
+instanceSaver(NULL),
 
 ServerEventBindings(NULL),
 PlayerEventBindings(NULL),
@@ -190,6 +241,22 @@ CreatureUniqueBindings(NULL)
     // Set event manager. Must be after setting sEluna
     // on multithread have a map of state pointers and here insert this pointer to the map and then save a pointer of that pointer to the EventMgr
     eventMgr = new EventMgr(&Eluna::GEluna);
+
+    // Inbox for messages sent through channels
+    channelMgr = new ElunaChannelMgr(this);
+
+    // Worker states for RunAsync
+    workerPool = new ElunaWorkerPool(this);
+
+    // Callbacks for async database queries
+    queryProcessor = new ElunaQueryProcessor(this);
+
+    // Queues reloads when scripts change
+    scriptWatcher = new ElunaScriptWatcher();
+    scriptWatcher->Watch(lua_scriptfolders);
+
+    // Writes instance data in the background
+    instanceSaver = new ElunaInstanceSaver();
 }
 
 Eluna::~Eluna()
@@ -200,6 +267,22 @@ Eluna::~Eluna()
 
     delete eventMgr;
     eventMgr = NULL;
+
+    delete channelMgr;
+    channelMgr = NULL;
+
+    delete workerPool;
+    workerPool = NULL;
+
+    delete queryProcessor;
+    queryProcessor = NULL;
+
+    delete scriptWatcher;
+    scriptWatcher = NULL;
+
+    // Writes the saves that are still queued, if OnShutdown did not already
+    delete instanceSaver;
+    instanceSaver = NULL;
 }
 
 void Eluna::CloseLua()
@@ -208,13 +291,28 @@ void Eluna::CloseLua()
 
     DestroyBindStores();
 
+    // Handler refs die with the lua state
+    if (channelMgr)
+        channelMgr->ClearHandlers();
+    if (workerPool)
+        workerPool->ClearJobs();
+    if (queryProcessor)
+        queryProcessor->ClearCallbacks();
+
     // Must close lua state after deleting stores and mgr
     if (L)
         lua_close(L);
     L = NULL;
 
+    instanceDataFreed += instanceDataRefs.size() + continentDataRefs.size();
     instanceDataRefs.clear();
+    dirtyDataRefs.clear();
+    instanceEventMasks.clear();
     continentDataRefs.clear();
+
+    // Module bindings and refs died with the lua state
+    scriptModules.clear();
+    loadingModule = NULL;
 }
 
 void Eluna::OpenLua()
@@ -237,10 +335,24 @@ void Eluna::OpenLua()
     luaL_openlibs(L);
 
     // open additional lua libraries
+    luaopen_marshal(L);
+    lua_pushvalue(L, -1);
+    lua_setglobal(L, "marshal");
+    // `require("marshal")` returns the same table
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "loaded");
+    lua_pushvalue(L, -3);
+    lua_setfield(L, -2, "marshal");
+    lua_pop(L, 3);
 
     // Register methods and functions
     RegisterFunctions(this);
 
+    // Scripts loaded with `require` are modules of their own
+    lua_getglobal(L, "require");
+    lua_pushcclosure(L, &Eluna::Require, 1);
+    lua_setglobal(L, "require");
+
     // Set lua require folder paths (scripts folder structure)
     lua_getglobal(L, "package");
     lua_pushstring(L, lua_requirepath.c_str());
@@ -318,7 +430,7 @@ void Eluna::DestroyBindStores()
     CreatureUniqueBindings = NULL;
 }
 
-void Eluna::AddScriptPath(std::string filename, const std::string& fullpath)
+void Eluna::AddScriptPath(std::string filename, const std::string& fullpath, int64 mtime, uint64 size)
 {
     ELUNA_LOG_DEBUG("[Eluna]: AddScriptPath Checking file `%s`", fullpath.c_str());
 
@@ -339,6 +451,8 @@ void Eluna::AddScriptPath(std::string filename, const std::string& fullpath)
     script.filename = filename;
     script.filepath = fullpath;
     script.modulepath = fullpath.substr(0, fullpath.length() - filename.length() - ext.length());
+    script.mtime = mtime;
+    script.size = size;
     if (extension)
         lua_extensions.push_back(script);
     else
@@ -357,6 +471,7 @@ void Eluna::GetScripts(std::string path)
 
     if (boost::filesystem::exists(someDir) && boost::filesystem::is_directory(someDir))
     {
+        lua_scriptfolders.push_back(path);
         lua_requirepath +=
             path + "/?.lua;" +
             path + "/?.ext;" +
@@ -389,7 +504,10 @@ void Eluna::GetScripts(std::string path)
             {
                 // was file, try add
                 std::string filename = dir_iter->path().filename().generic_string();
-                AddScriptPath(filename, fullpath);
+                boost::system::error_code ec;
+                int64 mtime = int64(boost::filesystem::last_write_time(dir_iter->path(), ec));
+                uint64 size = uint64(boost::filesystem::file_size(dir_iter->path(), ec));
+                AddScriptPath(filename, fullpath, mtime, size);
             }
         }
     }
@@ -398,6 +516,7 @@ void Eluna::GetScripts(std::string path)
     if (dir.open(path.c_str()) == -1) // Error opening directory, return
         return;
 
+    lua_scriptfolders.push_back(path);
     lua_requirepath +=
         path + "/?.lua;" +
         path + "/?.ext;" +
@@ -437,7 +556,7 @@ void Eluna::GetScripts(std::string path)
 
         // was file, try add
         std::string filename = directory->d_name;
-        AddScriptPath(filename, fullpath);
+        AddScriptPath(filename, fullpath, int64(stat_buf.st_mtime), uint64(stat_buf.st_size));
     }
 #endif
 }
@@ -463,12 +582,30 @@ void Eluna::RunScripts()
     scripts.insert(scripts.end(), lua_scripts.begin(), lua_scripts.end());
 
     std::unordered_map<std::string, std::string> loaded; // filename, path
+    ElunaBytecodeCache cache(lua_folderpath);
 
     lua_getglobal(L, "package");
     // Stack: package
     luaL_getsubtable(L, -1, "loaded");
     // Stack: package, modules
     int modules = lua_gettop(L);
+
+    // Compile the scripts in parallel, only running them has to happen in order on this state
+    {
+        std::vector<std::string> filepaths;
+        std::unordered_set<std::string> filenames;
+        for (ScriptList::const_iterator it = scripts.begin(); it != scripts.end(); ++it)
+        {
+            if (!filenames.insert(it->filename).second)
+                continue;
+
+            lua_getfield(L, modules, it->filename.c_str());
+            if (lua_isnoneornil(L, -1))
+                filepaths.push_back(it->filepath);
+            lua_pop(L, 1);
+        }
+        cache.Precompile(filepaths);
+    }
     for (ScriptList::const_iterator it = scripts.begin(); it != scripts.end(); ++it)
     {
         // Check that no duplicate names exist
@@ -485,44 +622,336 @@ void Eluna::RunScripts()
         {
             lua_pop(L, 1);
             ELUNA_LOG_DEBUG("[Eluna]: `%s` was already loaded or required", it->filepath.c_str());
+
+            // Still track the file so an incremental reload notices when it changes,
+            //   a required script is tracked since it was required
+            ElunaModule& module = scriptModules[it->filename];
+            if (!module.id)
+                module.id = ++lastModuleId;
+            module.script = *it;
             continue;
         }
         lua_pop(L, 1);
         // Stack: package, modules
 
-        if (luaL_loadfile(L, it->filepath.c_str()))
-        {
-            // Stack: package, modules, errmsg
-            ELUNA_LOG_ERROR("[Eluna]: Error loading `%s`", it->filepath.c_str());
-            Report(L);
-            // Stack: package, modules
+        if (RunScript(*it, modules, cache))
+            ++count;
+    }
+    // Stack: package, modules
+    lua_pop(L, 2);
+    if (cache.IsEnabled())
+    {
+        ELUNA_LOG_INFO("[Eluna]: Executed %u Lua scripts in %u ms (bytecode cache: %u hits, %u misses, %u ms compile time saved)",
+            count, ElunaUtil::GetTimeDiff(oldMSTime), cache.GetHits(), cache.GetMisses(), uint32(cache.GetSavedTime() / 1000));
+    }
+    else
+    {
+        ELUNA_LOG_INFO("[Eluna]: Executed %u Lua scripts in %u ms", count, ElunaUtil::GetTimeDiff(oldMSTime));
+    }
+    ReportScriptLoadStats();
+
+    OnLuaStateOpen();
+}
+
+bool Eluna::RunScript(const LuaScript& script, int loadedIndex, ElunaBytecodeCache& cache)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    ElunaModule& module = scriptModules[script.filename];
+    // A script required under another name before it ran is still loaded under that name
+    std::vector<std::string> requiredNames;
+    requiredNames.swap(module.requiredNames);
+    module = ElunaModule();
+    module.requiredNames.swap(requiredNames);
+    module.id = ++lastModuleId;
+    module.script = script;
+
+    Clock::time_point loadStart = Clock::now();
+    int status = cache.LoadFile(L, script.filepath);
+    module.compileTime = cache.GetLastCompileTime();
+    module.loadTime = uint64(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - loadStart).count());
+    if (status)
+    {
+        // Stack: errmsg
+        ELUNA_LOG_ERROR("[Eluna]: Error loading `%s`", script.filepath.c_str());
+        Report(L);
+        return false;
+    }
+    // Stack: filefunc
+
+    int64 memoryBefore = int64(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+    Clock::time_point runStart = Clock::now();
+
+    // Bindings and timed events made by the chunk belong to the module
+    ElunaModule* previousModule = loadingModule;
+    loadingModule = &module;
+    bool success = ExecuteCall(0, 1);
+    loadingModule = previousModule;
+    // Stack: result
+
+    module.runTime = uint64(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - runStart).count()) - module.requiredTime;
+    module.memory = int64(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0) - memoryBefore;
+    module.executed = true;
+
+    if (!success)
+    {
+        lua_pop(L, 1);
+        return false;
+    }
+
+    if (lua_isnoneornil(L, -1) || (lua_isboolean(L, -1) && !lua_toboolean(L, -1)))
+    {
+        // if result evaluates to false, change it to true
+        lua_pop(L, 1);
+        Push(L, true);
+    }
+    lua_setfield(L, loadedIndex, script.filename.c_str());
+
+    // successfully loaded and ran file
+    ELUNA_LOG_DEBUG("[Eluna]: Successfully loaded `%s`", script.filepath.c_str());
+    return true;
+}
+
+static bool IsScriptChanged(const LuaScript& first, const LuaScript& second)
+{
+    return first.filepath != second.filepath || first.mtime != second.mtime || first.size != second.size;
+}
+
+bool Eluna::ReloadModules()
+{
+    LOCK_ELUNA;
+    if (!IsEnabled() || !HasLuaState())
+        return false;
+
+    uint32 oldMSTime = ElunaUtil::GetCurrTime();
+
+    ScriptList oldExtensions = lua_extensions;
+    LoadScriptPaths();
+
+    // Every script may depend on the extensions, so changing them needs a full reload
+    if (oldExtensions.size() != lua_extensions.size())
+        return false;
+    oldExtensions.sort(ScriptPathComparator);
+    lua_extensions.sort(ScriptPathComparator);
+    for (ScriptList::const_iterator it = oldExtensions.begin(), it2 = lua_extensions.begin(); it != oldExtensions.end(); ++it, ++it2)
+        if (IsScriptChanged(*it, *it2))
+            return false;
+
+    lua_scripts.sort(ScriptPathComparator);
+
+    // Folders may have been added or removed
+    lua_getglobal(L, "package");
+    lua_pushstring(L, lua_requirepath.c_str());
+    lua_setfield(L, -2, "path");
+    lua_pop(L, 1);
+
+    ScriptList changed;
+    std::unordered_set<std::string> found;
+    for (ScriptList::const_iterator it = lua_extensions.begin(); it != lua_extensions.end(); ++it)
+        found.insert(it->filename);
+    for (ScriptList::const_iterator it = lua_scripts.begin(); it != lua_scripts.end(); ++it)
+    {
+        // Duplicate names are reported by the full reload, skip them here
+        if (!found.insert(it->filename).second)
             continue;
-        }
-        // Stack: package, modules, filefunc
 
-        if (ExecuteCall(0, 1))
-        {
-            // Stack: package, modules, result
-            if (lua_isnoneornil(L, -1) || (lua_isboolean(L, -1) && !lua_toboolean(L, -1)))
-            {
-                // if result evaluates to false, change it to true
-                lua_pop(L, 1);
-                Push(L, true);
-            }
-            lua_setfield(L, modules, it->filename.c_str());
-            // Stack: package, modules
+        auto module = scriptModules.find(it->filename);
+        if (module == scriptModules.end() || IsScriptChanged(module->second.script, *it))
+            changed.push_back(*it);
+    }
 
-            // successfully loaded and ran file
-            ELUNA_LOG_DEBUG("[Eluna]: Successfully loaded `%s`", it->filepath.c_str());
-            ++count;
+    std::vector<std::string> removed;
+    for (auto it = scriptModules.begin(); it != scriptModules.end(); ++it)
+        if (found.find(it->first) == found.end())
+            removed.push_back(it->first);
+
+    for (std::vector<std::string>::const_iterator it = removed.begin(); it != removed.end(); ++it)
+        UnloadModule(*it);
+    for (ScriptList::const_iterator it = changed.begin(); it != changed.end(); ++it)
+        UnloadModule(it->filename);
+
+    uint32 count = 0;
+    ElunaBytecodeCache cache(lua_folderpath);
+    {
+        std::vector<std::string> filepaths;
+        for (ScriptList::const_iterator it = changed.begin(); it != changed.end(); ++it)
+            filepaths.push_back(it->filepath);
+        cache.Precompile(filepaths);
+    }
+
+    lua_getglobal(L, "package");
+    // Stack: package
+    luaL_getsubtable(L, -1, "loaded");
+    // Stack: package, modules
+    int loadedIndex = lua_gettop(L);
+    for (ScriptList::const_iterator it = changed.begin(); it != changed.end(); ++it)
+    {
+        // Required by a script that ran before it
+        lua_getfield(L, loadedIndex, it->filename.c_str());
+        bool loaded = !lua_isnoneornil(L, -1);
+        lua_pop(L, 1);
+        if (loaded)
             continue;
-        }
+
+        if (RunScript(*it, loadedIndex, cache))
+            ++count;
     }
     // Stack: package, modules
     lua_pop(L, 2);
-    ELUNA_LOG_INFO("[Eluna]: Executed %u Lua scripts in %u ms", count, ElunaUtil::GetTimeDiff(oldMSTime));
 
-    OnLuaStateOpen();
+    ELUNA_LOG_INFO("[Eluna]: Reloaded %u of %u changed Lua scripts and unloaded %u removed scripts in %u ms",
+        count, uint32(changed.size()), uint32(removed.size()), ElunaUtil::GetTimeDiff(oldMSTime));
+    return true;
+}
+
+void Eluna::UnloadModule(const std::string& filename)
+{
+    auto it = scriptModules.find(filename);
+    if (it == scriptModules.end())
+        return;
+
+    ElunaModule& module = it->second;
+    for (std::vector<std::function<void()> >::const_iterator remove = module.bindings.begin(); remove != module.bindings.end(); ++remove)
+        (*remove)();
+
+    eventMgr->SetModuleStates(module.id, LUAEVENT_STATE_ABORT);
+
+    // Let the script be run and required again
+    lua_getglobal(L, "package");
+    luaL_getsubtable(L, -1, "loaded");
+    lua_pushnil(L);
+    lua_setfield(L, -2, filename.c_str());
+    for (std::vector<std::string>::const_iterator name = module.requiredNames.begin(); name != module.requiredNames.end(); ++name)
+    {
+        lua_pushnil(L);
+        lua_setfield(L, -2, name->c_str());
+    }
+    lua_pop(L, 2);
+
+    scriptModules.erase(it);
+}
+
+int Eluna::Require(lua_State* L)
+{
+    // No C++ objects with destructors here, errors raised by `require` pass through
+    Eluna* E = Eluna::GetEluna(L);
+    const char* name = luaL_checkstring(L, 1);
+    lua_settop(L, 1);
+
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    // Stack: require, name
+
+    // `require("folder.script")` loads the script named `script`
+    const char* filename = strrchr(name, '.');
+    filename = filename ? filename + 1 : name;
+
+    const LuaScript* script = NULL;
+    for (ScriptList::const_iterator it = lua_scripts.begin(); it != lua_scripts.end() && !script; ++it)
+        if (it->filename == filename)
+            script = &*it;
+    for (ScriptList::const_iterator it = lua_extensions.begin(); it != lua_extensions.end() && !script; ++it)
+        if (it->filename == filename)
+            script = &*it;
+
+    lua_getglobal(L, "package");
+    lua_getfield(L, -1, "loaded");
+    lua_getfield(L, -1, name);
+    bool loaded = !lua_isnoneornil(L, -1);
+    lua_pop(L, 3);
+    // Stack: require, name
+
+    // Files outside the script folders and loaded modules are not run, nothing to track
+    if (!script || loaded)
+    {
+        lua_call(L, 1, LUA_MULTRET);
+        return lua_gettop(L);
+    }
+
+    ElunaModule& module = E->scriptModules[script->filename];
+    if (!module.id)
+    {
+        module.id = ++E->lastModuleId;
+        module.script = *script;
+    }
+    if (std::find(module.requiredNames.begin(), module.requiredNames.end(), name) == module.requiredNames.end())
+        module.requiredNames.push_back(name);
+
+    typedef std::chrono::steady_clock Clock;
+
+    // Loading the file is part of the run time, `require` does not use the bytecode cache
+    module.requiredTime = 0;
+    int64 memoryBefore = int64(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+    Clock::time_point runStart = Clock::now();
+
+    ElunaModule* previousModule = E->loadingModule;
+    E->loadingModule = &module;
+    int status = lua_pcall(L, 1, LUA_MULTRET, 0);
+    E->loadingModule = previousModule;
+
+    uint64 runTime = uint64(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - runStart).count());
+    module.runTime = runTime - module.requiredTime;
+    module.memory = int64(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0) - memoryBefore;
+    module.executed = true;
+    // Not counted again in the run time of the script that required it
+    if (previousModule)
+        previousModule->requiredTime += runTime;
+
+    if (status)
+        return lua_error(L);
+    return lua_gettop(L);
+}
+
+void Eluna::AddModuleBinding(const std::function<void()>& remove)
+{
+    if (loadingModule)
+        loadingModule->bindings.push_back(remove);
+}
+
+uint32 Eluna::AddModuleEvent()
+{
+    if (!loadingModule)
+        return 0;
+
+    ++loadingModule->events;
+    return loadingModule->id;
+}
+
+static bool ModuleLoadTimeComparator(const ElunaModule* first, const ElunaModule* second)
+{
+    if (first->GetTotalTime() != second->GetTotalTime())
+        return first->GetTotalTime() > second->GetTotalTime();
+    return first->script.filepath < second->script.filepath;
+}
+
+void Eluna::GetScriptLoadStats(std::vector<const ElunaModule*>& stats) const
+{
+    for (auto it = scriptModules.begin(); it != scriptModules.end(); ++it)
+        if (it->second.executed)
+            stats.push_back(&it->second);
+
+    std::sort(stats.begin(), stats.end(), ModuleLoadTimeComparator);
+}
+
+void Eluna::ReportScriptLoadStats() const
+{
+    uint32 limit = eConfigMgr->GetIntDefault("Eluna.ScriptLoadReport", 10);
+    if (!limit)
+        return;
+
+    std::vector<const ElunaModule*> stats;
+    GetScriptLoadStats(stats);
+    if (stats.size() > limit)
+        stats.resize(limit);
+
+    ELUNA_LOG_INFO("[Eluna]: Slowest Lua scripts to load (compile ms, load ms, run ms, memory KiB, bindings, timed events):");
+    for (std::vector<const ElunaModule*>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+    {
+        const ElunaModule* module = *it;
+        ELUNA_LOG_INFO("[Eluna]:   %8.2f %8.2f %8.2f %10.1f %5u %5u  %s",
+            module->compileTime / 1000.0, module->loadTime / 1000.0, module->runTime / 1000.0, module->memory / 1024.0,
+            uint32(module->bindings.size()), module->events, module->script.filepath.c_str());
+    }
 }
 
 void Eluna::InvalidateObjects()
@@ -754,6 +1183,25 @@ void Eluna::Push(lua_State* luastate, Object const* obj)
             ElunaTemplate<Object>::Push(luastate, obj);
     }
 }
+int Eluna::PushResultTable(lua_State* luastate, int index, int narr)
+{
+    if (lua_isnoneornil(luastate, index))
+        lua_createtable(luastate, narr, 0);
+    else
+    {
+        luaL_checktype(luastate, index, LUA_TTABLE);
+        lua_pushvalue(luastate, index);
+    }
+    return lua_gettop(luastate);
+}
+void Eluna::TrimResultTable(lua_State* luastate, int tbl, uint32 count)
+{
+    for (size_t i = lua_rawlen(luastate, tbl); i > count; --i)
+    {
+        lua_pushnil(luastate);
+        lua_rawseti(luastate, tbl, i);
+    }
+}
 void Eluna::Push(lua_State* luastate, ObjectGuid const guid)
 {
     ElunaTemplate<unsigned long long>::Push(luastate, new unsigned long long(guid.GetRawValue()));
@@ -940,6 +1388,9 @@ static int cancelBinding(lua_State *L)
 template<typename K>
 static void createCancelCallback(lua_State* L, uint64 bindingID, BindingMap<K>* bindings)
 {
+    // Let an incremental reload remove the binding along with the module that made it
+    Eluna::GetEluna(L)->AddModuleBinding([bindings, bindingID]() { bindings->Remove(bindingID); });
+
     Eluna::Push(L, bindingID);
     lua_pushlightuserdata(L, bindings);
     // Stack: bindingID, bindings
@@ -1174,6 +1625,7 @@ int Eluna::Register(lua_State* L, uint8 regtype, uint32 entry, ObjectGuid guid,
                 auto key = EntryKey<Hooks::InstanceEvents>((Hooks::InstanceEvents)event_id, entry);
                 bindingID = InstanceEventBindings->Insert(key, functionRef, shots);
                 createCancelCallback(L, bindingID, InstanceEventBindings);
+                instanceEventMasks[entry] |= 1 << event_id;
                 return 1; // Stack: callback
             }
             break;
@@ -1289,7 +1741,9 @@ void Eluna::CreateInstanceData(Map const* map)
         auto mapRef = continentDataRefs.find(mapId);
         if (mapRef != continentDataRefs.end())
         {
+            dirtyDataRefs.erase(mapRef->second);
             luaL_unref(L, LUA_REGISTRYINDEX, mapRef->second);
+            ++instanceDataFreed;
         }
 
         continentDataRefs[mapId] = ref;
@@ -1302,11 +1756,48 @@ void Eluna::CreateInstanceData(Map const* map)
         auto instRef = instanceDataRefs.find(instanceId);
         if (instRef != instanceDataRefs.end())
         {
+            dirtyDataRefs.erase(instRef->second);
             luaL_unref(L, LUA_REGISTRYINDEX, instRef->second);
+            ++instanceDataFreed;
         }
 
         instanceDataRefs[instanceId] = ref;
     }
+
+    // New data was never saved
+    dirtyDataRefs.insert(ref);
+    ++instanceDataCreated;
+}
+
+static int GetInstanceDataRef(std::unordered_map<uint32, int> const& refs, uint32 id)
+{
+    auto itr = refs.find(id);
+    return itr != refs.end() ? itr->second : LUA_NOREF;
+}
+
+bool Eluna::IsInstanceDataDirty(Map const* map)
+{
+    if (!map->Instanceable())
+        return dirtyDataRefs.count(GetInstanceDataRef(continentDataRefs, map->GetId())) != 0;
+    else
+        return dirtyDataRefs.count(GetInstanceDataRef(instanceDataRefs, map->GetInstanceId())) != 0;
+}
+
+void Eluna::SetInstanceDataDirty(Map const* map, bool dirty)
+{
+    int ref;
+    if (!map->Instanceable())
+        ref = GetInstanceDataRef(continentDataRefs, map->GetId());
+    else
+        ref = GetInstanceDataRef(instanceDataRefs, map->GetInstanceId());
+
+    if (ref == LUA_NOREF)
+        return;
+
+    if (dirty)
+        dirtyDataRefs.insert(ref);
+    else
+        dirtyDataRefs.erase(ref);
 }
 
 /*
@@ -1317,41 +1808,59 @@ void Eluna::FreeInstanceId(uint32 instanceId)
 {
     LOCK_ELUNA;
 
+    // The ID can be reused by a new instance, whose row must not get this instance's data
+    instanceSaver->Drop(instanceId);
+
     if (!IsEnabled())
         return;
 
-    for (int i = 1; i < Hooks::INSTANCE_EVENT_COUNT; ++i)
+    auto events = instanceEventMasks.find(instanceId);
+    if (events != instanceEventMasks.end())
     {
-        auto key = EntryKey<Hooks::InstanceEvents>((Hooks::InstanceEvents)i, instanceId);
-
-        if (MapEventBindings->HasBindingsFor(key))
-            MapEventBindings->Clear(key);
-
-        if (InstanceEventBindings->HasBindingsFor(key))
-            InstanceEventBindings->Clear(key);
-
-        if (instanceDataRefs.find(instanceId) != instanceDataRefs.end())
+        for (int i = 1; i < Hooks::INSTANCE_EVENT_COUNT; ++i)
         {
-            luaL_unref(L, LUA_REGISTRYINDEX, instanceDataRefs[instanceId]);
-            instanceDataRefs.erase(instanceId);
+            if (events->second & (1 << i))
+                InstanceEventBindings->Clear(EntryKey<Hooks::InstanceEvents>((Hooks::InstanceEvents)i, instanceId));
         }
+        instanceEventMasks.erase(events);
+    }
+
+    auto dataRef = instanceDataRefs.find(instanceId);
+    if (dataRef != instanceDataRefs.end())
+    {
+        dirtyDataRefs.erase(dataRef->second);
+        luaL_unref(L, LUA_REGISTRYINDEX, dataRef->second);
+        instanceDataRefs.erase(dataRef);
+        ++instanceDataFreed;
     }
 }
 
-void Eluna::PushInstanceData(lua_State* L, ElunaInstanceAI* ai, bool incrementCounter)
+void Eluna::PushInstanceData(lua_State* L, ElunaInstanceAI* ai, bool incrementCounter, bool track)
 {
     // Check if the instance data is missing (i.e. someone reloaded Eluna).
     if (!HasInstanceData(ai->instance))
         ai->Reload();
 
     // Get the instance data table from the registry.
+    int ref;
     if (!ai->instance->Instanceable())
-        lua_rawgeti(L, LUA_REGISTRYINDEX, continentDataRefs[ai->instance->GetId()]);
+        ref = continentDataRefs[ai->instance->GetId()];
     else
-        lua_rawgeti(L, LUA_REGISTRYINDEX, instanceDataRefs[ai->instance->GetInstanceId()]);
+        ref = instanceDataRefs[ai->instance->GetInstanceId()];
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
 
     ASSERT(lua_istable(L, -1));
 
+    if (ai->FlushDataSlots(L, -1))
+        MarkInstanceDataDirty(ref);
+
+    // Lua can write anything to the table from here on
+    if (track)
+    {
+        ai->ResetDataSlots();
+        MarkInstanceDataDirty(ref);
+    }
+
     if (incrementCounter)
         ++push_counter;
 }
@@ -36,6 +36,7 @@
 #endif
 #include "Hooks.h"
 #include "ElunaUtility.h"
+#include <functional>
 #include <mutex>
 #include <memory>
 
@@ -117,6 +118,11 @@ typedef VehicleInfo Vehicle;
 
 struct lua_State;
 class EventMgr;
+class ElunaChannelMgr;
+class ElunaWorkerPool;
+class ElunaQueryProcessor;
+class ElunaScriptWatcher;
+class ElunaInstanceSaver;
 class ElunaObject;
 template<typename T> class ElunaTemplate;
 
@@ -125,12 +131,49 @@ template<typename T> struct EventKey;
 template<typename T> struct EntryKey;
 template<typename T> struct UniqueObjectKey;
 
+class ElunaBytecodeCache;
+
 struct LuaScript
 {
     std::string fileext;
     std::string filename;
     std::string filepath;
     std::string modulepath;
+    int64 mtime;
+    uint64 size;
+};
+
+/*
+ * A script executed by `Eluna::RunScript` and what its top-level execution registered,
+ *   so an incremental reload can undo it.
+ */
+struct ElunaModule
+{
+    ElunaModule() : id(0), executed(false), compileTime(0), loadTime(0), runTime(0), requiredTime(0), memory(0), events(0) { }
+
+    uint32 id;
+    LuaScript script;
+    // Removes one binding made by the module when called
+    std::vector<std::function<void()> > bindings;
+    // Names the module was required under, its `package.loaded` keys besides the filename
+    std::vector<std::string> requiredNames;
+
+    // Load statistics, in microseconds and bytes
+    bool executed;
+    uint64 compileTime;     // Time spent compiling, also off the world thread, 0 if loaded from the bytecode cache
+    uint64 loadTime;        // Time spent loading the chunk on the world thread
+    uint64 runTime;         // Time spent running the top-level chunk, without the scripts it required
+    uint64 requiredTime;    // Time spent running the scripts it required
+    int64 memory;           // Lua heap growth while running the top-level chunk
+    uint32 events;          // Timed events registered by the top-level chunk
+
+    uint64 GetTotalTime() const { return loadTime + runTime; }
+};
+
+enum ElunaReloadMode
+{
+    ELUNA_RELOAD_FULL,          // Close the Lua state and run all scripts again
+    ELUNA_RELOAD_INCREMENTAL,   // Run only added and changed scripts again in the current Lua state
 };
 
 #define ELUNA_STATE_PTR "Eluna State Ptr"
@@ -154,6 +197,8 @@ public:
 
 private:
     static bool reload;
+    // The queued reload only needs to run changed scripts again
+    static bool reloadChanged;
     static bool initialized;
     static LockType lock;
 
@@ -163,6 +208,8 @@ private:
 
     // Lua script folder path
     static std::string lua_folderpath;
+    // Lua script folder and its subfolders
+    static std::vector<std::string> lua_scriptfolders;
     // lua path variable for require() function
     static std::string lua_requirepath;
 
@@ -184,6 +231,20 @@ private:
     std::unordered_map<uint32, int> instanceDataRefs;
     // Map from map ID -> Lua table ref
     std::unordered_map<uint32, int> continentDataRefs;
+    // Refs of instance and continent data tables changed since they were last saved or loaded
+    std::unordered_set<int> dirtyDataRefs;
+    // Map from instance ID -> bit mask of the InstanceEvents it has instance bindings for,
+    //   so FreeInstanceId only clears the events that were registered
+    std::unordered_map<uint32, uint32> instanceEventMasks;
+    // Instance and continent data tables created and freed since startup
+    uint64 instanceDataCreated;
+    uint64 instanceDataFreed;
+
+    // Map from script filename -> module, for incremental reloads
+    std::unordered_map<std::string, ElunaModule> scriptModules;
+    // The module whose top-level chunk is running, also while it's run by `require`, NULL otherwise
+    ElunaModule* loadingModule;
+    uint32 lastModuleId;
 
     Eluna();
     ~Eluna();
@@ -204,7 +265,18 @@ private:
     static void _ReloadEluna();
     static void LoadScriptPaths();
     static void GetScripts(std::string path);
-    static void AddScriptPath(std::string filename, const std::string& fullpath);
+    static void AddScriptPath(std::string filename, const std::string& fullpath, int64 mtime, uint64 size);
+
+    // Loads and runs `script`, storing its result in the `package.loaded` table at `loadedIndex`
+    bool RunScript(const LuaScript& script, int loadedIndex, ElunaBytecodeCache& cache);
+    // Runs added and changed scripts again in the current Lua state. Returns false if a full reload is needed.
+    bool ReloadModules();
+    // Removes the bindings and timed events the module registered while loading
+    void UnloadModule(const std::string& filename);
+    // Replaces `require`, the original is the first upvalue. Runs required scripts as their own module.
+    static int Require(lua_State* L);
+    // Logs the slowest scripts to load, up to `Eluna.ScriptLoadReport` of them
+    void ReportScriptLoadStats() const;
 
     static int StackTrace(lua_State *_L);
     static void Report(lua_State* _L);
@@ -256,6 +328,11 @@ public:
 
     lua_State* L;
     EventMgr* eventMgr;
+    ElunaChannelMgr* channelMgr;
+    ElunaWorkerPool* workerPool;
+    ElunaQueryProcessor* queryProcessor;
+    ElunaScriptWatcher* scriptWatcher;
+    ElunaInstanceSaver* instanceSaver;
 
     BindingMap< EventKey<Hooks::ServerEvents> >*     ServerEventBindings;
     BindingMap< EventKey<Hooks::PlayerEvents> >*     PlayerEventBindings;
@@ -280,7 +357,9 @@ public:
     static void Initialize();
     static void Uninitialize();
     // This function is used to make eluna reload
-    static void ReloadEluna() { LOCK_ELUNA; reload = true; }
+    static void ReloadEluna() { LOCK_ELUNA; reload = true; reloadChanged = false; }
+    // Makes eluna run changed scripts again, unless a full reload is already queued
+    static void ReloadChangedScripts() { LOCK_ELUNA; if (!reload) { reload = true; reloadChanged = true; } }
     static LockType& GetLock() { return lock; };
     static bool IsInitialized() { return initialized; }
     // Never returns nullptr
@@ -320,6 +399,17 @@ public:
         ElunaTemplate<T>::Push(luastate, ptr);
     }
 
+    /*
+     * Methods that return a list can fill a table passed by the script instead of
+     *   creating a new one, so scripts calling them often don't create garbage.
+     *
+     * `PushResultTable` pushes the table at `index`, or a new table with room for `narr`
+     *   entries if that argument is nil or missing, and returns its stack index.
+     * `TrimResultTable` removes the entries after the first `count` that a reused table still held.
+     */
+    static int PushResultTable(lua_State* luastate, int index, int narr);
+    static void TrimResultTable(lua_State* luastate, int tbl, uint32 count);
+
     /*
      * Returns `true` if Eluna has instance data for `map`.
      */
@@ -331,6 +421,25 @@ public:
      */
     void CreateInstanceData(Map const* map);
 
+    /*
+     * Returns `true` if the instance data for `map` may have changed since
+     *   it was last saved or loaded.
+     *
+     * Instance data is dirty when it's created, when the table was passed to Lua,
+     *   which can write to it at any time after, and when `MarkInstanceDataDirty`
+     *   is called. `ElunaInstanceAI::Save` compares dirty data with the last save.
+     */
+    bool IsInstanceDataDirty(Map const* map);
+    void SetInstanceDataDirty(Map const* map, bool dirty);
+    // Marks the instance data table with the registry ref `ref` as dirty
+    void MarkInstanceDataDirty(int ref) { dirtyDataRefs.insert(ref); }
+
+    uint32 GetInstanceDataCount() const { return instanceDataRefs.size(); }
+    uint32 GetContinentDataCount() const { return continentDataRefs.size(); }
+    uint32 GetDirtyDataCount() const { return dirtyDataRefs.size(); }
+    uint64 GetInstanceDataCreated() const { return instanceDataCreated; }
+    uint64 GetInstanceDataFreed() const { return instanceDataFreed; }
+
     /*
      * Retrieve the instance data for the `Map` scripted by `ai` and push it
      *   onto the stack.
@@ -341,11 +450,20 @@ public:
      * In that case, the AI is "reloaded" (new instance data table is created
      *   and loaded with the last known save state, and `Load`/`Initialize`
      *   hooks are called).
+     *
+     * Unless `track` is false, the table is going to Lua scripts, so the
+     *   instance data is marked dirty and the data slots of `ai` are emptied.
      */
-    void PushInstanceData(lua_State* L, ElunaInstanceAI* ai, bool incrementCounter = true);
+    void PushInstanceData(lua_State* L, ElunaInstanceAI* ai, bool incrementCounter = true, bool track = true);
 
     void RunScripts();
     bool ShouldReload() const { return reload; }
+    // Tracks a binding made by the module being loaded, if any
+    void AddModuleBinding(const std::function<void()>& remove);
+    // Tracks a timed event added by the module being loaded, if any. Returns the ID of the module or 0.
+    uint32 AddModuleEvent();
+    // Fills `stats` with the executed modules, slowest first
+    void GetScriptLoadStats(std::vector<const ElunaModule*>& stats) const;
     bool IsEnabled() const { return enabled && IsInitialized(); }
     bool HasLuaState() const { return L != NULL; }
     uint64 GetCallstackId() const { return callstackid; }
@@ -369,6 +487,10 @@ public:
 
     /* Custom */
     void OnTimedEvent(int funcRef, uint32 delay, uint32 calls, WorldObject* obj);
+    void OnChannelMessage(const std::vector<int>& functionRefs, const std::string& channel, const std::string& data);
+    void OnAsyncResult(int funcRef, bool success, const std::string& data);
+    void OnQueryResult(int funcRef, ElunaQuery* result);
+    void OnTransactionResult(int funcRef, bool success);
     bool OnCommand(Player* player, const char* text);
     void OnWorldUpdate(uint32 diff);
     void OnLootItem(Player* pPlayer, Item* pItem, uint32 count, ObjectGuid guid);
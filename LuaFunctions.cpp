@@ -27,6 +27,8 @@ extern "C"
 #include "GuildMethods.h"
 #include "GameObjectMethods.h"
 #include "ElunaQueryMethods.h"
+#include "ElunaStatementMethods.h"
+#include "ElunaTransactionMethods.h"
 #include "AuraMethods.h"
 #include "ItemMethods.h"
 #include "WorldPacketMethods.h"
@@ -173,6 +175,12 @@ void RegisterFunctions(Eluna* E)
     ElunaTemplate<ElunaQuery>::Register(E, "ElunaQuery", true);
     ElunaTemplate<ElunaQuery>::SetMethods(E, LuaQuery::QueryMethods);
 
+    ElunaTemplate<ElunaStatement>::Register(E, "ElunaStatement", true);
+    ElunaTemplate<ElunaStatement>::SetMethods(E, LuaStatement::StatementMethods);
+
+    ElunaTemplate<ElunaTransaction>::Register(E, "ElunaTransaction", true);
+    ElunaTemplate<ElunaTransaction>::SetMethods(E, LuaTransaction::TransactionMethods);
+
     ElunaTemplate<long long>::Register(E, "long long", true);
 
     ElunaTemplate<unsigned long long>::Register(E, "unsigned long long", true);
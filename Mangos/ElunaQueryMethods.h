@@ -266,6 +266,49 @@ namespace LuaQuery
         return 1;
     }
 
+    // Returns true if the values of the column are pushed to Lua as numbers
+    static bool IsNumericField(Field const& field)
+    {
+        // MYSQL_TYPE_LONGLONG Interpreted as string for lua
+        switch (field.GetType())
+        {
+#if defined TRINITY || AZEROTHCORE
+            case DatabaseFieldTypes::Int8:
+            case DatabaseFieldTypes::Int16:
+            case DatabaseFieldTypes::Int32:
+            case DatabaseFieldTypes::Int64:
+            case DatabaseFieldTypes::Float:
+            case DatabaseFieldTypes::Double:
+#else
+            case MYSQL_TYPE_TINY:
+            case MYSQL_TYPE_SHORT:
+            case MYSQL_TYPE_INT24:
+            case MYSQL_TYPE_LONG:
+            case MYSQL_TYPE_FLOAT:
+            case MYSQL_TYPE_DOUBLE:
+#endif
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    static void PushField(lua_State* L, Field const& field, bool numeric)
+    {
+#if defined TRINITY || AZEROTHCORE
+        const char* str = field.GetCString();
+        if (field.IsNull() || !str)
+#else
+        const char* str = field.GetString();
+        if (field.IsNULL() || !str)
+#endif
+            Eluna::Push(L);
+        else if (numeric)
+            Eluna::Push(L, strtod(str, NULL));
+        else
+            Eluna::Push(L, str);
+    }
+
     /**
      * Returns a table from the current row where keys are field names and values are the row's values.
      *
@@ -279,6 +322,8 @@ namespace LuaQuery
      *
      *     { entry = 123, name = "some creature name" }
      *
+     * Results of async queries have no column names, their columns are keyed by column index instead.
+     *
      * To move to next row use [ElunaQuery:NextRow].
      *
      * @return table rowData : table filled with row columns and data where `T[column] = data`
@@ -299,81 +344,299 @@ namespace LuaQuery
         {
 #if defined TRINITY || AZEROTHCORE
             Eluna::Push(L, RESULT->GetFieldName(i));
-
-            const char* str = row[i].GetCString();
-            if (row[i].IsNull() || !str)
-                Eluna::Push(L);
-            else
-            {
-                // MYSQL_TYPE_LONGLONG Interpreted as string for lua
-                switch (row[i].GetType())
-                {
-#if defined TRINITY || AZEROTHCORE
-                    case DatabaseFieldTypes::Int8:
-                    case DatabaseFieldTypes::Int16:
-                    case DatabaseFieldTypes::Int32:
-                    case DatabaseFieldTypes::Int64:
-                    case DatabaseFieldTypes::Float:
-                    case DatabaseFieldTypes::Double:
 #else
-                    case MYSQL_TYPE_TINY:
-                    case MYSQL_TYPE_YEAR:
-                    case MYSQL_TYPE_SHORT:
-                    case MYSQL_TYPE_INT24:
-                    case MYSQL_TYPE_LONG:
-                    case MYSQL_TYPE_LONGLONG:
-                    case MYSQL_TYPE_BIT:
-                    case MYSQL_TYPE_FLOAT:
-                    case MYSQL_TYPE_DOUBLE:
-                    case MYSQL_TYPE_DECIMAL:
-                    case MYSQL_TYPE_NEWDECIMAL:
+            // Results of async queries have no column names
+            if (i < names.size())
+                Eluna::Push(L, names[i]);
+            else
+                Eluna::Push(L, i);
 #endif
-                        Eluna::Push(L, strtod(str, NULL));
-                        break;
-                    default:
-                        Eluna::Push(L, str);
-                        break;
+            PushField(L, row[i], IsNumericField(row[i]));
+            lua_rawset(L, tbl);
         }
+
+        lua_settop(L, tbl);
+        return 1;
     }
+
+    /**
+     * Returns the rows from the current row onwards in one table and moves the [ElunaQuery] past them.
+     *
+     * By default every row is a table like the ones returned by [ElunaQuery:GetRow], stored in an array:
+     *
+     *     { { entry = 123, name = "some name" }, { entry = 124, name = "other name" } }
+     *
+     * With `columnar` set the values are grouped by column instead:
+     *
+     *     { entry = { 123, 124 }, name = { "some name", "other name" } }
+     *
+     * In the columnar layout `NULL` values leave holes in the column arrays.
+     *
+     * Column names and types are resolved once for the whole call instead of once per row.
+     * Once every row was read, the query has no current row and further calls return an empty table.
+     *
+     *     local Q = WorldDBQuery("SELECT entry, name FROM creature_template")
+     *     if Q then
+     *         for _, row in ipairs(Q:GetRows()) do
+     *             print(row.entry, row.name)
+     *         end
+     *     end
+     *
+     * @param uint32 limit = 0 : maximum amount of rows to return, 0 returns all remaining rows
+     * @param bool columnar = false : group the values by column
+     * @return table rows
+     */
+    int GetRows(lua_State* L, ElunaQuery* result)
+    {
+        uint32 limit = Eluna::CHECKVAL<uint32>(L, 2, 0);
+        bool columnar = Eluna::CHECKVAL<bool>(L, 3, false);
+
+        uint32 col = RESULT->GetFieldCount();
+        Field* row = RESULT->Fetch();
+
+        uint64 rows = row ? RESULT->GetRowCount() : 0;
+        int prealloc = int(std::min<uint64>(limit ? limit : rows, std::min<uint64>(rows, INT_MAX)));
+
+        lua_createtable(L, columnar ? 0 : prealloc, columnar ? col : 0);
+        int tbl = lua_gettop(L);
+        if (!row)
+            return 1;
+
+        luaL_checkstack(L, col * 2 + 2, "too many columns");
+
+#if !defined TRINITY && !AZEROTHCORE
+        const QueryFieldNames& names = RESULT->GetFieldNames();
+#endif
+
+        // Intern the column names once, they are at keys + i
+        int keys = lua_gettop(L) + 1;
+        std::vector<bool> numeric(col);
+        for (uint32 i = 0; i < col; ++i)
+        {
+#if defined TRINITY || AZEROTHCORE
+            Eluna::Push(L, RESULT->GetFieldName(i));
 #else
-            Eluna::Push(L, names[i]);
+            // Results of async queries have no column names
+            if (i < names.size())
+                Eluna::Push(L, names[i]);
+            else
+                Eluna::Push(L, i);
+#endif
+            numeric[i] = IsNumericField(row[i]);
+        }
+
+        // Column arrays are at columns + i
+        int columns = lua_gettop(L) + 1;
+        if (columnar)
+        {
+            for (uint32 i = 0; i < col; ++i)
+            {
+                lua_createtable(L, prealloc, 0);
+                lua_pushvalue(L, keys + i);
+                lua_pushvalue(L, -2);
+                lua_rawset(L, tbl);
+            }
+        }
 
-            const char* str = row[i].GetString();
-            if (row[i].IsNULL() || !str)
-                Eluna::Push(L);
+        int n = 0;
+        while (row && (!limit || uint32(n) < limit))
+        {
+            ++n;
+            if (columnar)
+            {
+                for (uint32 i = 0; i < col; ++i)
+                {
+                    PushField(L, row[i], numeric[i]);
+                    lua_rawseti(L, columns + i, n);
+                }
+            }
             else
             {
-                // MYSQL_TYPE_LONGLONG Interpreted as string for lua
-                switch (row[i].GetType())
+                lua_createtable(L, 0, col);
+                for (uint32 i = 0; i < col; ++i)
                 {
-                    case MYSQL_TYPE_TINY:
-                    case MYSQL_TYPE_SHORT:
-                    case MYSQL_TYPE_INT24:
-                    case MYSQL_TYPE_LONG:
-                    case MYSQL_TYPE_FLOAT:
-                    case MYSQL_TYPE_DOUBLE:
-                        Eluna::Push(L, strtod(str, NULL));
-                        break;
-                    default:
-                        Eluna::Push(L, str);
-                        break;
+                    lua_pushvalue(L, keys + i);
+                    PushField(L, row[i], numeric[i]);
+                    lua_rawset(L, -3);
                 }
+                lua_rawseti(L, tbl, n);
             }
-#endif
 
-            lua_rawset(L, tbl);
+            row = RESULT->NextRow() ? RESULT->Fetch() : NULL;
         }
 
         lua_settop(L, tbl);
         return 1;
     }
-    
+
+    // Fills `rowTbl` with each of the next `batchSize` rows and calls `fn` with it.
+    // Returns true if rows are left and `fn` did not return false.
+    static bool ForEachRowBatch(lua_State* L, ElunaQuery* result, int fn, int rowTbl, uint32 batchSize, uint32& processed)
+    {
+        Field* row = RESULT->Fetch();
+        if (!row)
+            return false;
+
+        uint32 col = RESULT->GetFieldCount();
+        luaL_checkstack(L, col + 4, "too many columns");
+
+#if !defined TRINITY && !AZEROTHCORE
+        const QueryFieldNames& names = RESULT->GetFieldNames();
+#endif
+
+        // Intern the column names once per batch, they are at keys + i
+        int keys = lua_gettop(L) + 1;
+        std::vector<bool> numeric(col);
+        for (uint32 i = 0; i < col; ++i)
+        {
+#if defined TRINITY || AZEROTHCORE
+            Eluna::Push(L, RESULT->GetFieldName(i));
+#else
+            // Results of async queries have no column names
+            if (i < names.size())
+                Eluna::Push(L, names[i]);
+            else
+                Eluna::Push(L, i);
+#endif
+            numeric[i] = IsNumericField(row[i]);
+        }
+
+        bool proceed = true;
+        for (uint32 n = 0; row && proceed && n < batchSize; ++n)
+        {
+            for (uint32 i = 0; i < col; ++i)
+            {
+                lua_pushvalue(L, keys + i);
+                PushField(L, row[i], numeric[i]);
+                lua_rawset(L, rowTbl);
+            }
+
+            lua_pushvalue(L, fn);
+            lua_pushvalue(L, rowTbl);
+            Eluna::Push(L, ++processed);
+            lua_call(L, 2, 1);
+            proceed = !lua_isboolean(L, -1) || lua_toboolean(L, -1);
+            lua_pop(L, 1);
+
+            row = RESULT->NextRow() ? RESULT->Fetch() : NULL;
+        }
+
+        lua_settop(L, keys - 1);
+        return proceed && row;
+    }
+
+    static void ScheduleForEachRow(lua_State* L, int query, int fn, uint32 batchSize, int callback, uint32 processed, int rowTbl);
+
+    // Timed event that handles the next batch of an ElunaQuery:ForEachRow started with `yield`
+    static int ContinueForEachRow(lua_State* L)
+    {
+        // Upvalues: query, function, batch size, callback, processed rows, row table
+        for (int i = 1; i <= 6; ++i)
+            lua_pushvalue(L, lua_upvalueindex(i));
+        int base = lua_gettop(L) - 5;
+
+        ElunaQuery* result = Eluna::CHECKOBJ<ElunaQuery>(L, base, false);
+        if (!result)
+            return 0;
+
+        uint32 batchSize = Eluna::CHECKVAL<uint32>(L, base + 2);
+        uint32 processed = Eluna::CHECKVAL<uint32>(L, base + 4);
+
+        if (ForEachRowBatch(L, result, base + 1, base + 5, batchSize, processed))
+            ScheduleForEachRow(L, base, base + 1, batchSize, base + 3, processed, base + 5);
+        else if (!lua_isnil(L, base + 3))
+        {
+            lua_pushvalue(L, base + 3);
+            Eluna::Push(L, processed);
+            lua_call(L, 1, 0);
+        }
+        return 0;
+    }
+
+    static void ScheduleForEachRow(lua_State* L, int query, int fn, uint32 batchSize, int callback, uint32 processed, int rowTbl)
+    {
+        lua_pushvalue(L, query);
+        lua_pushvalue(L, fn);
+        Eluna::Push(L, batchSize);
+        lua_pushvalue(L, callback);
+        Eluna::Push(L, processed);
+        lua_pushvalue(L, rowTbl);
+        lua_pushcclosure(L, &ContinueForEachRow, 6);
+
+        // A delay of at least 1 ms makes the event run on the next world update
+        int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (functionRef != LUA_REFNIL && functionRef != LUA_NOREF)
+            Eluna::GetEluna(L)->eventMgr->globalProcessor->AddEvent(functionRef, 1, 1, 1);
+    }
+
+    /**
+     * Calls `function` for every row from the current row onwards, converting the rows in batches of `batchSize`.
+     *
+     * The function is called with the parameters `(row, rowNumber)`, where `row` is a table like the ones
+     * returned by [ElunaQuery:GetRow]. The same `row` table is reused for every row, so copy the values
+     * you want to keep. Returning `false` from the function stops the iteration.
+     *
+     * With `yield` set only one batch is handled right away, and each following batch is handled on a later world update
+     * through a timed event, so large results do not block the world update.
+     * The query is kept alive until all rows were handled.
+     *
+     * `callback` is called with the parameter `(rowCount)` once the iteration ends.
+     *
+     *     local Q = CharDBQuery("SELECT guid, name FROM characters")
+     *     if Q then
+     *         Q:ForEachRow(function(row)
+     *             print(row.guid, row.name)
+     *         end, 500, true, function(count)
+     *             print("handled", count, "characters")
+     *         end)
+     *     end
+     *
+     * @param function function : function to call for every row
+     * @param uint32 batchSize = 1000 : amount of rows to handle per batch
+     * @param bool yield = false : handle the batches on consecutive world updates
+     * @param function callback = nil : function to call once all rows were handled
+     * @return uint32 rowCount : amount of rows handled so far
+     */
+    int ForEachRow(lua_State* L, ElunaQuery* result)
+    {
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+        uint32 batchSize = Eluna::CHECKVAL<uint32>(L, 3, 1000);
+        bool yield = Eluna::CHECKVAL<bool>(L, 4, false);
+        if (!lua_isnoneornil(L, 5))
+            luaL_checktype(L, 5, LUA_TFUNCTION);
+        if (!batchSize)
+            return luaL_argerror(L, 3, "batch size must be above 0");
+
+        lua_settop(L, 5);
+        lua_createtable(L, 0, RESULT->GetFieldCount());
+        int rowTbl = lua_gettop(L);
+
+        uint32 processed = 0;
+        bool more = ForEachRowBatch(L, result, 2, rowTbl, batchSize, processed);
+        while (more && !yield)
+            more = ForEachRowBatch(L, result, 2, rowTbl, batchSize, processed);
+
+        if (more)
+            ScheduleForEachRow(L, 1, 2, batchSize, 5, processed, rowTbl);
+        else if (!lua_isnil(L, 5))
+        {
+            lua_pushvalue(L, 5);
+            Eluna::Push(L, processed);
+            lua_call(L, 1, 0);
+        }
+
+        lua_pop(L, 1);
+        Eluna::Push(L, processed);
+        return 1;
+    }
+
     ElunaRegister<ElunaQuery> QueryMethods[] =
     {
         // Getters
         { "GetColumnCount", &LuaQuery::GetColumnCount },
         { "GetRowCount", &LuaQuery::GetRowCount },
         { "GetRow", &LuaQuery::GetRow },
+        { "GetRows", &LuaQuery::GetRows },
         { "GetBool", &LuaQuery::GetBool },
         { "GetUInt8", &LuaQuery::GetUInt8 },
         { "GetUInt16", &LuaQuery::GetUInt16 },
@@ -389,6 +652,7 @@ namespace LuaQuery
 
         // Boolean
         { "NextRow", &LuaQuery::NextRow },
+        { "ForEachRow", &LuaQuery::ForEachRow },
         { "IsNull", &LuaQuery::IsNull },
 
         { NULL, NULL }
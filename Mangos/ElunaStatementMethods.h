@@ -0,0 +1,175 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef STATEMENTMETHODS_H
+#define STATEMENTMETHODS_H
+
+/***
+ * A SQL statement with `?` placeholders, parsed once and executed with bound parameters.
+ *
+ * Parameters are converted to SQL by their Lua type: nil is `NULL`, booleans are `1` or `0`,
+ * numbers and 64-bit integers keep their value and strings are escaped and quoted.
+ *
+ * E.g. the return value of [Global:CreateStatement].
+ *
+ * Inherits all methods from: none
+ */
+namespace LuaStatement
+{
+    // Binds the values from `first` up to the top of the stack, starting from parameter 0
+    static void BindArgs(lua_State* L, ElunaStatement* stmt, int first, int last)
+    {
+        for (int i = first; i <= last; ++i)
+        {
+            std::string literal;
+            if (!ElunaStatement::ToLiteral(L, i, stmt->GetDatabase(), literal))
+                luaL_argerror(L, i, "value can not be converted to SQL");
+            if (!stmt->Bind(uint32(i - first), literal))
+                luaL_argerror(L, i, "too many parameters for the statement");
+        }
+
+        uint32 unbound = stmt->GetUnboundParam();
+        if (unbound < stmt->GetParamCount())
+            luaL_error(L, "parameter %d of the statement is not bound", int(unbound));
+    }
+
+    /**
+     * Returns the number of `?` placeholders in the statement.
+     *
+     * @return uint32 paramCount
+     */
+    int GetParamCount(lua_State* L, ElunaStatement* stmt)
+    {
+        Eluna::Push(L, stmt->GetParamCount());
+        return 1;
+    }
+
+    /**
+     * Returns the SQL text the statement was created with.
+     *
+     * @return string sql
+     */
+    int GetSQL(lua_State* L, ElunaStatement* stmt)
+    {
+        Eluna::Push(L, stmt->GetSql());
+        return 1;
+    }
+
+    /**
+     * Binds `value` to the parameter at `index`. Indexes start from 0.
+     *
+     * Bound values are kept until they are replaced or [ElunaStatement:ClearParams] is called.
+     *
+     * @param uint32 index
+     * @param value : nil, boolean, number, 64-bit integer or string
+     */
+    int Bind(lua_State* L, ElunaStatement* stmt)
+    {
+        uint32 index = Eluna::CHECKVAL<uint32>(L, 2);
+        luaL_checkany(L, 3);
+
+        std::string literal;
+        if (!ElunaStatement::ToLiteral(L, 3, stmt->GetDatabase(), literal))
+            return luaL_argerror(L, 3, "value can not be converted to SQL");
+        if (!stmt->Bind(index, literal))
+            return luaL_argerror(L, 2, "parameter index out of range");
+        return 0;
+    }
+
+    /**
+     * Unbinds all parameters.
+     */
+    int ClearParams(lua_State* /*L*/, ElunaStatement* stmt)
+    {
+        stmt->ClearParams();
+        return 0;
+    }
+
+    /**
+     * Executes the statement synchronously and returns an [ElunaQuery].
+     *
+     * Passed values are bound to the parameters in order, starting from parameter 0.
+     *
+     *     local stmt = CreateStatement(0, "SELECT name FROM creature_template WHERE entry = ?")
+     *     local Q = stmt:Query(123)
+     *
+     * @param ... : values to bind
+     * @return [ElunaQuery] results or nil if no rows found
+     */
+    int Query(lua_State* L, ElunaStatement* stmt)
+    {
+        BindArgs(L, stmt, 2, lua_gettop(L));
+
+        Eluna::Push(L, stmt->Query());
+        return 1;
+    }
+
+    /**
+     * Executes the statement, the results are ignored.
+     *
+     * Passed values are bound to the parameters in order, starting from parameter 0.
+     *
+     * The statement may be executed *asynchronously* (at a later, unpredictable time).
+     *
+     * @param ... : values to bind
+     */
+    int Execute(lua_State* L, ElunaStatement* stmt)
+    {
+        BindArgs(L, stmt, 2, lua_gettop(L));
+
+        stmt->Execute();
+        return 0;
+    }
+
+    /**
+     * Executes the statement without blocking and passes the [ElunaQuery] to `callback` on a later world update.
+     *
+     * Passed values are bound to the parameters in order, starting from parameter 0.
+     * The callback receives nil if no rows were found.
+     *
+     * @param ... : values to bind
+     * @param function callback : function to call with the results
+     * @return bool queued : true if the query was queued
+     */
+    int QueryAsync(lua_State* L, ElunaStatement* stmt)
+    {
+        int top = lua_gettop(L);
+        luaL_checktype(L, top, LUA_TFUNCTION);
+        BindArgs(L, stmt, 2, top - 1);
+
+        lua_pushvalue(L, top);
+        int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (functionRef == LUA_REFNIL || functionRef == LUA_NOREF)
+            return luaL_argerror(L, top, "unable to make a ref to function");
+
+        bool queued = Eluna::GetEluna(L)->queryProcessor->Query(stmt->GetDatabase(), stmt->Render().c_str(), functionRef);
+        if (!queued)
+            luaL_unref(L, LUA_REGISTRYINDEX, functionRef);
+
+        Eluna::Push(L, queued);
+        return 1;
+    }
+
+    ElunaRegister<ElunaStatement> StatementMethods[] =
+    {
+        // Getters
+        { "GetParamCount", &LuaStatement::GetParamCount },
+        { "GetSQL", &LuaStatement::GetSQL },
+
+        // Setters
+        { "Bind", &LuaStatement::Bind },
+        { "ClearParams", &LuaStatement::ClearParams },
+
+        // Other
+        { "Query", &LuaStatement::Query },
+        { "Execute", &LuaStatement::Execute },
+        { "QueryAsync", &LuaStatement::QueryAsync },
+
+        { NULL, NULL }
+    };
+};
+
+#endif
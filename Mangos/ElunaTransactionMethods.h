@@ -0,0 +1,117 @@
+/*
+* Copyright (C) 2010 - 2016 Eluna Lua Engine <http://emudevs.com/>
+* This program is free software licensed under GPL version 3
+* Please see the included DOCS/LICENSE.md for more information
+*/
+
+#ifndef TRANSACTIONMETHODS_H
+#define TRANSACTIONMETHODS_H
+
+/***
+ * A batch of SQL statements committed to the database as one transaction.
+ *
+ * E.g. the return value of [Global:CharDBTransaction].
+ *
+ *     local tx = CharDBTransaction()
+ *     for guid, points in pairs(scores) do
+ *         tx:Append("REPLACE INTO my_scores (guid, points) VALUES (?, ?)", guid, points)
+ *     end
+ *     tx:Commit(function(success) print("saved", success) end)
+ *
+ * Inherits all methods from: none
+ */
+namespace LuaTransaction
+{
+    /**
+     * Appends a statement to the transaction.
+     *
+     * The statement may have `?` placeholders, the passed values are bound to them in order
+     * the same way as with [ElunaStatement].
+     *
+     * @param string sql : statement to append
+     * @param ... : values to bind
+     */
+    int Append(lua_State* L, ElunaTransaction* transaction)
+    {
+        std::string sql = Eluna::CHECKVAL<std::string>(L, 2);
+        int top = lua_gettop(L);
+
+        if (transaction->IsCommitted())
+            return luaL_error(L, "transaction was already committed");
+
+        ElunaSqlTemplatePtr sqlTemplate = ElunaSqlTemplateCache::Get(transaction->GetDatabase(), sql);
+        if (int(sqlTemplate->GetParamCount()) != top - 2)
+            return luaL_error(L, "statement has %d parameters but %d values were passed", int(sqlTemplate->GetParamCount()), top - 2);
+
+        std::vector<std::string> params(sqlTemplate->GetParamCount());
+        for (int i = 3; i <= top; ++i)
+        {
+            if (!ElunaStatement::ToLiteral(L, i, transaction->GetDatabase(), params[i - 3]))
+                return luaL_argerror(L, i, "value can not be converted to SQL");
+        }
+
+        transaction->Append(sqlTemplate->Render(params));
+        return 0;
+    }
+
+    /**
+     * Returns the number of statements in the transaction.
+     *
+     * @return uint32 statementCount
+     */
+    int GetStatementCount(lua_State* L, ElunaTransaction* transaction)
+    {
+        Eluna::Push(L, transaction->GetStatementCount());
+        return 1;
+    }
+
+    /**
+     * Commits all appended statements as one transaction without blocking.
+     *
+     * A transaction can only be committed once.
+     *
+     * If a callback is passed, it is called on a later world update with the parameter `(success)`.
+     * On MaNGOS based cores the core does not report when the commit finishes,
+     * so the callback is called on the next world update with whether the core accepted the transaction.
+     *
+     * @param function callback = nil : function to call once the transaction completed
+     * @return bool committed : true if the transaction was handed to the database
+     */
+    int Commit(lua_State* L, ElunaTransaction* transaction)
+    {
+        bool hasCallback = !lua_isnoneornil(L, 2);
+        if (hasCallback)
+            luaL_checktype(L, 2, LUA_TFUNCTION);
+
+        if (transaction->IsCommitted())
+            return luaL_error(L, "transaction was already committed");
+        transaction->SetCommitted();
+
+        int functionRef = LUA_NOREF;
+        if (hasCallback)
+        {
+            lua_pushvalue(L, 2);
+            functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+            if (functionRef == LUA_REFNIL || functionRef == LUA_NOREF)
+                return luaL_argerror(L, 2, "unable to make a ref to function");
+        }
+
+        bool committed = Eluna::GetEluna(L)->queryProcessor->CommitTransaction(transaction, functionRef);
+        Eluna::Push(L, committed);
+        return 1;
+    }
+
+    ElunaRegister<ElunaTransaction> TransactionMethods[] =
+    {
+        // Getters
+        { "GetStatementCount", &LuaTransaction::GetStatementCount },
+
+        // Other
+        { "Append", &LuaTransaction::Append },
+        { "Commit", &LuaTransaction::Commit },
+
+        { NULL, NULL }
+    };
+};
+
+#endif
@@ -9,8 +9,14 @@
 #include "LuaEngine.h"
 #include "BindingMap.h"
 #include "ElunaEventMgr.h"
+#include "ElunaChannelMgr.h"
+#include "ElunaWorkerPool.h"
+#include "ElunaQueryProcessor.h"
+#include "ElunaScriptWatcher.h"
+#include "ElunaInstanceSaver.h"
 #include "ElunaIncludes.h"
 #include "ElunaTemplate.h"
+#include "lmarshal.h"
 
 using namespace Hooks;
 
@@ -85,6 +91,130 @@ void Eluna::OnTimedEvent(int funcRef, uint32 delay, uint32 calls, WorldObject* o
     InvalidateObjects();
 }
 
+void Eluna::OnChannelMessage(const std::vector<int>& functionRefs, const std::string& channel, const std::string& data)
+{
+    LOCK_ELUNA;
+    ASSERT(!event_level);
+
+    // Deserialize the value once and pass it to every handler
+    lua_pushcfunction(L, mar_decode);
+    lua_pushlstring(L, data.c_str(), data.size());
+    if (lua_pcall(L, 1, 1, 0))
+    {
+        ELUNA_LOG_ERROR("[Eluna]: Failed to decode message on channel `%s`: %s", channel.c_str(), lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return;
+    }
+    int value = lua_gettop(L);
+
+    for (std::vector<int>::const_iterator it = functionRefs.begin(); it != functionRefs.end(); ++it)
+    {
+        // Get function
+        lua_rawgeti(L, LUA_REGISTRYINDEX, *it);
+
+        // Push parameters
+        Push(L, channel);
+        lua_pushvalue(L, value);
+
+        // Call function
+        ExecuteCall(2, 0);
+    }
+    lua_pop(L, 1);
+
+    ASSERT(!event_level);
+    InvalidateObjects();
+}
+
+void Eluna::OnAsyncResult(int funcRef, bool success, const std::string& data)
+{
+    LOCK_ELUNA;
+    ASSERT(!event_level);
+
+    // Get function, the callback is only called once
+    lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, funcRef);
+
+    // Push parameters
+    Push(L, success);
+    int params = 1;
+    if (!success)
+    {
+        Push(L, data);
+        ++params;
+    }
+    else
+    {
+        lua_pushcfunction(L, mar_decode);
+        lua_pushlstring(L, data.c_str(), data.size());
+        if (lua_pcall(L, 1, 1, 0))
+        {
+            ELUNA_LOG_ERROR("[Eluna]: Failed to decode async result: %s", lua_tostring(L, -1));
+            lua_pop(L, 3);
+            return;
+        }
+
+        // Unpack the returned values
+        int packed = lua_gettop(L);
+        lua_getfield(L, packed, "n");
+        int resc = int(lua_tointeger(L, -1));
+        lua_pop(L, 1);
+        if (resc < 0 || !lua_checkstack(L, resc))
+        {
+            ELUNA_LOG_ERROR("[Eluna]: Too many async results to unpack: %i", resc);
+            lua_pop(L, 3);
+            return;
+        }
+        for (int i = 1; i <= resc; ++i)
+            lua_rawgeti(L, packed, i);
+        lua_remove(L, packed);
+        params += resc;
+    }
+
+    // Call function
+    ExecuteCall(params, 0);
+
+    ASSERT(!event_level);
+    InvalidateObjects();
+}
+
+void Eluna::OnQueryResult(int funcRef, ElunaQuery* result)
+{
+    LOCK_ELUNA;
+    ASSERT(!event_level);
+
+    // Get function, the callback is only called once
+    lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, funcRef);
+
+    // Push parameters, the result is owned by Lua
+    Push(L, result);
+
+    // Call function
+    ExecuteCall(1, 0);
+
+    ASSERT(!event_level);
+    InvalidateObjects();
+}
+
+void Eluna::OnTransactionResult(int funcRef, bool success)
+{
+    LOCK_ELUNA;
+    ASSERT(!event_level);
+
+    // Get function, the callback is only called once
+    lua_rawgeti(L, LUA_REGISTRYINDEX, funcRef);
+    luaL_unref(L, LUA_REGISTRYINDEX, funcRef);
+
+    // Push parameters
+    Push(L, success);
+
+    // Call function
+    ExecuteCall(1, 0);
+
+    ASSERT(!event_level);
+    InvalidateObjects();
+}
+
 void Eluna::OnGameEventStart(uint32 eventid)
 {
     START_HOOK(GAME_EVENT_START);
@@ -316,12 +446,22 @@ void Eluna::OnWorldUpdate(uint32 diff)
 {
     {
         LOCK_ELUNA;
+        if (scriptWatcher->ConsumeChanges())
+            ReloadChangedScripts();
         if (ShouldReload())
             _ReloadEluna();
     }
 
     eventMgr->globalProcessor->Update(diff);
 
+    // Deliver messages sent to this state's channels
+    {
+        LOCK_ELUNA;
+        channelMgr->Update();
+        workerPool->Update();
+        queryProcessor->Update();
+    }
+
     START_HOOK(WORLD_EVENT_ON_UPDATE);
     Push(diff);
     CallAllFunctions(ServerEventBindings, key);
@@ -335,6 +475,13 @@ void Eluna::OnStartup()
 
 void Eluna::OnShutdown()
 {
+    // Queued instance saves are written while the character database is still open,
+    //   the core writes the saves made after this
+    {
+        LOCK_ELUNA;
+        instanceSaver->Stop();
+    }
+
     START_HOOK(WORLD_EVENT_ON_SHUTDOWN);
     CallAllFunctions(ServerEventBindings, key);
 }
@@ -8,6 +8,11 @@
 #define GLOBALMETHODS_H
 
 #include "BindingMap.h"
+#include "ElunaChannelMgr.h"
+#include "ElunaWorkerPool.h"
+#include "ElunaQueryProcessor.h"
+#include "ElunaStatement.h"
+#include "lmarshal.h"
 
 /***
  * These functions can be used anywhere at any time, including at start-up.
@@ -183,6 +188,174 @@ namespace LuaGlobalFunctions
         return 1;
     }
 
+    /**
+     * Returns values of many [WorldObject]s at once, such as their positions, as parallel arrays.
+     *
+     * Each object is read once and every field gets its own array, so `snapshot.x[i]`, `snapshot.y[i]` and so on
+     * belong to `objects[i]`. This is much cheaper than calling `GetX`, `GetY`, `GetGUIDLow` and so on for each object.
+     *
+     * The fields are `x`, `y`, `z`, `o`, `guidLow`, `entry`, `health`, `maxHealth` and `healthPct`.
+     * By default `x`, `y`, `z`, `o` and `guidLow` are returned. The health fields are 0 for objects that are not [Unit]s.
+     * Entries of `objects` that are not valid objects, for example because they were removed from the world,
+     * get 0 for every field, so their `guidLow` is 0.
+     *
+     *     local snapshot = GetUnitSnapshot(creature:GetCreaturesInRange(30), { "x", "y", "healthPct" })
+     *     for i = 1, #snapshot.x do
+     *         print(snapshot.x[i], snapshot.y[i], snapshot.healthPct[i])
+     *     end
+     *
+     * @param table objects : array of [WorldObject]s
+     * @param table fields = nil : array of the names of the fields to return
+     * @param table results = nil : table to fill and return instead of a new table, arrays it already has for the fields are refilled
+     * @return table snapshot : table with an array of values for each field
+     */
+    int GetUnitSnapshot(lua_State* L)
+    {
+        enum SnapshotField
+        {
+            SNAPSHOT_X,
+            SNAPSHOT_Y,
+            SNAPSHOT_Z,
+            SNAPSHOT_O,
+            SNAPSHOT_GUIDLOW,
+            SNAPSHOT_ENTRY,
+            SNAPSHOT_HEALTH,
+            SNAPSHOT_MAXHEALTH,
+            SNAPSHOT_HEALTHPCT,
+            MAX_SNAPSHOT_FIELDS
+        };
+        static const char* const fieldNames[MAX_SNAPSHOT_FIELDS] = { "x", "y", "z", "o", "guidLow", "entry", "health", "maxHealth", "healthPct" };
+
+        // All arguments are checked before any C++ object exists, errors skip their destructors
+        luaL_checktype(L, 1, LUA_TTABLE);
+        if (!lua_isnoneornil(L, 3))
+            luaL_checktype(L, 3, LUA_TTABLE);
+
+        // Each field once, in the order requested
+        uint8 requested[MAX_SNAPSHOT_FIELDS];
+        size_t fieldCount = 0;
+        if (lua_isnoneornil(L, 2))
+        {
+            for (uint8 f = SNAPSHOT_X; f <= SNAPSHOT_GUIDLOW; ++f)
+                requested[fieldCount++] = f;
+        }
+        else
+        {
+            luaL_checktype(L, 2, LUA_TTABLE);
+            uint32 seen = 0;
+            size_t nameCount = lua_rawlen(L, 2);
+            for (size_t i = 1; i <= nameCount; ++i)
+            {
+                lua_rawgeti(L, 2, i);
+                const char* name = lua_tostring(L, -1);
+                if (!name)
+                    return luaL_argerror(L, 2, "field names must be strings");
+
+                uint8 f = 0;
+                while (f < MAX_SNAPSHOT_FIELDS && strcmp(name, fieldNames[f]) != 0)
+                    ++f;
+                if (f == MAX_SNAPSHOT_FIELDS)
+                    return luaL_argerror(L, 2, lua_pushfstring(L, "unknown field `%s`", name));
+
+                if (!(seen & (1 << f)))
+                {
+                    seen |= 1 << f;
+                    requested[fieldCount++] = f;
+                }
+                lua_pop(L, 1);
+            }
+        }
+
+        std::vector<uint8> fields(requested, requested + fieldCount);
+        size_t count = lua_rawlen(L, 1);
+        std::vector<WorldObject*> objects(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            lua_rawgeti(L, 1, i + 1);
+            objects[i] = Eluna::CHECKOBJ<WorldObject>(L, -1, false);
+            lua_pop(L, 1);
+        }
+
+        // Read all fields of an object in one go, the values of each field are stored in their own column
+        std::vector<double> values(fields.size() * count, 0.0);
+        for (size_t i = 0; i < count; ++i)
+        {
+            WorldObject* obj = objects[i];
+            if (!obj)
+                continue;
+
+            Unit* unit = obj->ToUnit();
+            for (size_t f = 0; f < fields.size(); ++f)
+            {
+                double value = 0;
+                switch (fields[f])
+                {
+                    case SNAPSHOT_X:
+                        value = obj->GetPositionX();
+                        break;
+                    case SNAPSHOT_Y:
+                        value = obj->GetPositionY();
+                        break;
+                    case SNAPSHOT_Z:
+                        value = obj->GetPositionZ();
+                        break;
+                    case SNAPSHOT_O:
+                        value = obj->GetOrientation();
+                        break;
+                    case SNAPSHOT_GUIDLOW:
+                        value = obj->GetGUID().GetCounter();
+                        break;
+                    case SNAPSHOT_ENTRY:
+                        value = obj->GetEntry();
+                        break;
+                    case SNAPSHOT_HEALTH:
+                        value = unit ? unit->GetHealth() : 0;
+                        break;
+                    case SNAPSHOT_MAXHEALTH:
+                        value = unit ? unit->GetMaxHealth() : 0;
+                        break;
+                    case SNAPSHOT_HEALTHPCT:
+                        value = unit ? unit->GetHealthPct() : 0;
+                        break;
+                }
+                values[f * count + i] = value;
+            }
+        }
+
+        int tbl = Eluna::PushResultTable(L, 3, 0);
+        for (size_t f = 0; f < fields.size(); ++f)
+        {
+            const char* name = fieldNames[fields[f]];
+            lua_pushstring(L, name);
+            lua_rawget(L, tbl);
+            if (!lua_istable(L, -1))
+            {
+                lua_pop(L, 1);
+                lua_createtable(L, count, 0);
+                lua_pushstring(L, name);
+                lua_pushvalue(L, -2);
+                lua_rawset(L, tbl);
+            }
+            int column = lua_gettop(L);
+
+            const double* columnValues = &values[f * count];
+            bool integral = fields[f] >= SNAPSHOT_GUIDLOW && fields[f] <= SNAPSHOT_MAXHEALTH;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (integral)
+                    lua_pushinteger(L, lua_Integer(columnValues[i]));
+                else
+                    lua_pushnumber(L, columnValues[i]);
+                lua_rawseti(L, column, i + 1);
+            }
+            Eluna::TrimResultTable(L, column, count);
+            lua_pop(L, 1);
+        }
+
+        lua_settop(L, tbl);
+        return 1;
+    }
+
     /**
      * Returns a [Guild] by name.
      *
@@ -1176,6 +1349,54 @@ namespace LuaGlobalFunctions
         return 0;
     }
 
+    /**
+     * Returns load statistics of the scripts run since the last full reload, slowest first.
+     *
+     * Each entry of the returned array is a table with the fields:
+     * `name`, `path`, `compileTime`, `loadTime` and `runTime` in milliseconds,
+     * `memory` for the Lua heap growth in bytes while the script's top-level code ran,
+     * and `bindings` and `events` for the amount of event bindings and timed events it registered.
+     *
+     * `compileTime` is 0 for scripts loaded from the bytecode cache and may have been spent off the world thread.
+     *
+     *     for _, stat in ipairs(GetScriptLoadStats()) do
+     *         print(stat.name, stat.loadTime + stat.runTime)
+     *     end
+     *
+     * @return table stats : array of script load statistics
+     */
+    int GetScriptLoadStats(lua_State* L)
+    {
+        std::vector<const ElunaModule*> stats;
+        Eluna::GetEluna(L)->GetScriptLoadStats(stats);
+
+        lua_createtable(L, int(stats.size()), 0);
+        for (std::vector<const ElunaModule*>::size_type i = 0; i < stats.size(); ++i)
+        {
+            const ElunaModule* module = stats[i];
+
+            lua_createtable(L, 0, 8);
+            Eluna::Push(L, module->script.filename);
+            lua_setfield(L, -2, "name");
+            Eluna::Push(L, module->script.filepath);
+            lua_setfield(L, -2, "path");
+            Eluna::Push(L, module->compileTime / 1000.0);
+            lua_setfield(L, -2, "compileTime");
+            Eluna::Push(L, module->loadTime / 1000.0);
+            lua_setfield(L, -2, "loadTime");
+            Eluna::Push(L, module->runTime / 1000.0);
+            lua_setfield(L, -2, "runTime");
+            Eluna::Push(L, double(module->memory));
+            lua_setfield(L, -2, "memory");
+            Eluna::Push(L, uint32(module->bindings.size()));
+            lua_setfield(L, -2, "bindings");
+            Eluna::Push(L, module->events);
+            lua_setfield(L, -2, "events");
+            lua_rawseti(L, -2, int(i + 1));
+        }
+        return 1;
+    }
+
     /**
      * Runs a command.
      *
@@ -1343,6 +1564,185 @@ namespace LuaGlobalFunctions
         return 0;
     }
 
+    static int DBQueryAsync(lua_State* L, ElunaDatabase db)
+    {
+        const char* query = Eluna::CHECKVAL<const char*>(L, 1);
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+
+        lua_pushvalue(L, 2);
+        int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (functionRef == LUA_REFNIL || functionRef == LUA_NOREF)
+            return luaL_argerror(L, 2, "unable to make a ref to function");
+
+        bool queued = Eluna::GetEluna(L)->queryProcessor->Query(db, query, functionRef);
+        if (!queued)
+            luaL_unref(L, LUA_REGISTRYINDEX, functionRef);
+
+        Eluna::Push(L, queued);
+        return 1;
+    }
+
+    /**
+     * Executes a SQL query on the world database without blocking and passes the [ElunaQuery] to `callback`.
+     *
+     * The callback is called on a later world update with the parameter `(query)`,
+     *   where `query` is nil if no rows were found.
+     *
+     *     WorldDBQueryAsync("SELECT entry, name FROM creature_template LIMIT 10", function(Q)
+     *         if Q then
+     *             repeat
+     *                 print(Q:GetUInt32(0), Q:GetString(1))
+     *             until not Q:NextRow()
+     *         end
+     *     end)
+     *
+     * @param string sql : query to execute
+     * @param function callback : function to call with the results
+     * @return bool queued : true if the query was queued
+     */
+    int WorldDBQueryAsync(lua_State* L)
+    {
+        return DBQueryAsync(L, ELUNA_DB_WORLD);
+    }
+
+    /**
+     * Executes a SQL query on the character database without blocking and passes the [ElunaQuery] to `callback`.
+     *
+     * The callback is called on a later world update with the parameter `(query)`,
+     *   where `query` is nil if no rows were found.
+     *
+     * @param string sql : query to execute
+     * @param function callback : function to call with the results
+     * @return bool queued : true if the query was queued
+     */
+    int CharDBQueryAsync(lua_State* L)
+    {
+        return DBQueryAsync(L, ELUNA_DB_CHARACTER);
+    }
+
+    /**
+     * Executes a SQL query on the login database without blocking and passes the [ElunaQuery] to `callback`.
+     *
+     * The callback is called on a later world update with the parameter `(query)`,
+     *   where `query` is nil if no rows were found.
+     *
+     * @param string sql : query to execute
+     * @param function callback : function to call with the results
+     * @return bool queued : true if the query was queued
+     */
+    int AuthDBQueryAsync(lua_State* L)
+    {
+        return DBQueryAsync(L, ELUNA_DB_AUTH);
+    }
+
+    /**
+     * Returns the amount of async database queries in flight and the amount completed so far.
+     *
+     * @return uint32 inFlight : queries waiting for their results
+     * @return uint64 completed : queries whose results were received
+     */
+    int GetDBQueryStats(lua_State* L)
+    {
+        ElunaQueryProcessor* processor = Eluna::GetEluna(L)->queryProcessor;
+        Eluna::Push(L, processor->GetInFlight());
+        Eluna::Push(L, processor->GetCompleted());
+        return 2;
+    }
+
+    /**
+     * Creates a SQL statement with `?` placeholders for repeated execution and returns an [ElunaStatement].
+     *
+     * The statement is not prepared on the database server. Its SQL text is split at the placeholders once and cached,
+     * so creating a statement with the same text again is cheap, and each execution sends the text with the bound values in it.
+     * Parameters are bound by Lua type and strings are escaped, so values never need to be formatted into the SQL in Lua.
+     *
+     *     local stmt = CreateStatement(1, "UPDATE characters SET money = ? WHERE guid = ?")
+     *     stmt:Execute(1000, player:GetGUIDLow())
+     *
+     * <pre>
+     * enum ElunaDatabase
+     * {
+     *     ELUNA_DB_WORLD     = 0,
+     *     ELUNA_DB_CHARACTER = 1,
+     *     ELUNA_DB_AUTH      = 2
+     * };
+     * </pre>
+     *
+     * @param [ElunaDatabase] db : the database the statement is executed on
+     * @param string sql : statement with `?` in place of the values
+     * @return [ElunaStatement] statement
+     */
+    int CreateStatement(lua_State* L)
+    {
+        uint32 db = Eluna::CHECKVAL<uint32>(L, 1);
+        std::string sql = Eluna::CHECKVAL<std::string>(L, 2);
+
+        if (db > ELUNA_DB_AUTH)
+            return luaL_argerror(L, 1, "unknown database");
+
+        Eluna::Push(L, new ElunaStatement(ElunaSqlTemplateCache::Get(ElunaDatabase(db), sql)));
+        return 1;
+    }
+
+    /**
+     * Returns the amount of entries in the cache of parsed statement SQL and its hit and miss counts.
+     *
+     * @return uint32 size
+     * @return uint64 hits
+     * @return uint64 misses
+     */
+    int GetSqlTemplateCacheStats(lua_State* L)
+    {
+        Eluna::Push(L, ElunaSqlTemplateCache::GetSize());
+        Eluna::Push(L, ElunaSqlTemplateCache::GetHits());
+        Eluna::Push(L, ElunaSqlTemplateCache::GetMisses());
+        return 3;
+    }
+
+    /**
+     * Starts building a transaction on the world database and returns an [ElunaTransaction].
+     *
+     * Statements appended to it are sent to the database together when it is committed.
+     *
+     * @return [ElunaTransaction] transaction
+     */
+    int WorldDBTransaction(lua_State* L)
+    {
+        Eluna::Push(L, new ElunaTransaction(ELUNA_DB_WORLD));
+        return 1;
+    }
+
+    /**
+     * Starts building a transaction on the character database and returns an [ElunaTransaction].
+     *
+     * Statements appended to it are sent to the database together when it is committed.
+     *
+     *     local tx = CharDBTransaction()
+     *     tx:Append("DELETE FROM my_table WHERE guid = ?", guid)
+     *     tx:Append("INSERT INTO my_table (guid, data) VALUES (?, ?)", guid, data)
+     *     tx:Commit()
+     *
+     * @return [ElunaTransaction] transaction
+     */
+    int CharDBTransaction(lua_State* L)
+    {
+        Eluna::Push(L, new ElunaTransaction(ELUNA_DB_CHARACTER));
+        return 1;
+    }
+
+    /**
+     * Starts building a transaction on the login database and returns an [ElunaTransaction].
+     *
+     * Statements appended to it are sent to the database together when it is committed.
+     *
+     * @return [ElunaTransaction] transaction
+     */
+    int AuthDBTransaction(lua_State* L)
+    {
+        Eluna::Push(L, new ElunaTransaction(ELUNA_DB_AUTH));
+        return 1;
+    }
+
     /**
      * Registers a global timed event.
      *
@@ -1428,6 +1828,187 @@ namespace LuaGlobalFunctions
         return 0;
     }
 
+    /**
+     * Registers a handler for messages sent to `channel` with [Global:SendChannelMessage].
+     *
+     * Messages are delivered on world update in the order they were received.
+     * When the passed function is called, the parameters `(channel, value)` are passed to it.
+     *
+     * @param string channel : name of the channel to listen to
+     * @param function function : function to call for every message sent to the channel
+     */
+    int RegisterChannelHandler(lua_State* L)
+    {
+        std::string channel = Eluna::CHECKVAL<std::string>(L, 1);
+        luaL_checktype(L, 2, LUA_TFUNCTION);
+
+        lua_pushvalue(L, 2);
+        int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (functionRef != LUA_REFNIL && functionRef != LUA_NOREF)
+            Eluna::GetEluna(L)->channelMgr->AddHandler(channel, functionRef);
+        return 0;
+    }
+
+    /**
+     * Removes all handlers this Lua state registered for `channel`.
+     *
+     * @param string channel : name of the channel to stop listening to
+     */
+    int ClearChannelHandlers(lua_State* L)
+    {
+        std::string channel = Eluna::CHECKVAL<std::string>(L, 1);
+
+        Eluna::GetEluna(L)->channelMgr->ClearHandlers(channel);
+        return 0;
+    }
+
+    /**
+     * Sends `value` to every Lua state with handlers for `channel`, including this one.
+     *
+     * The value is serialized, so each receiver gets its own copy and tables are never shared between states.
+     * Only nil, booleans, numbers, strings, tables and Lua functions can be sent.
+     *
+     * A receiver whose inbox already holds `Eluna.ChannelQueueSize` pending messages drops the message.
+     *
+     * @param string channel : name of the channel to send to
+     * @param value : the value to send
+     * @return uint32 receivers : amount of states that accepted the message
+     */
+    int SendChannelMessage(lua_State* L)
+    {
+        std::string channel = Eluna::CHECKVAL<std::string>(L, 1);
+        luaL_checkany(L, 2);
+
+        lua_pushcfunction(L, mar_encode);
+        lua_pushvalue(L, 2);
+        lua_call(L, 1, 1);
+
+        size_t len;
+        const char* buf = lua_tolstring(L, -1, &len);
+        std::string data(buf, len);
+        lua_pop(L, 1);
+
+        Eluna::Push(L, Eluna::GetEluna(L)->channelMgr->Send(channel, data));
+        return 1;
+    }
+
+    /**
+     * Returns the message counters of this Lua state's channel inbox.
+     *
+     * The returned table has the fields `pending`, `capacity`, `sent`, `received`, `dropped` and `delivered`.
+     * `dropped` counts messages rejected because the inbox was full.
+     *
+     * @return table stats : channel message counters
+     */
+    int GetChannelStats(lua_State* L)
+    {
+        ElunaChannelMgr* mgr = Eluna::GetEluna(L)->channelMgr;
+
+        lua_createtable(L, 0, 6);
+        Eluna::Push(L, mgr->GetPending());
+        lua_setfield(L, -2, "pending");
+        Eluna::Push(L, mgr->GetCapacity());
+        lua_setfield(L, -2, "capacity");
+        Eluna::Push(L, mgr->GetSent());
+        lua_setfield(L, -2, "sent");
+        Eluna::Push(L, mgr->GetReceived());
+        lua_setfield(L, -2, "received");
+        Eluna::Push(L, mgr->GetDropped());
+        lua_setfield(L, -2, "dropped");
+        Eluna::Push(L, mgr->GetDelivered());
+        lua_setfield(L, -2, "delivered");
+        return 1;
+    }
+
+    /**
+     * Returns the counters of the instance and continent data tables of this Lua state.
+     *
+     * The returned table has the fields `instances`, `continents`, `dirty`, `created` and `freed`.
+     * `instances` and `continents` count the data tables alive, `dirty` those that may have changed since they were last saved.
+     * `created` and `freed` count the tables created and freed since the server started.
+     *
+     * @return table stats : instance data counters
+     */
+    int GetInstanceDataStats(lua_State* L)
+    {
+        Eluna* E = Eluna::GetEluna(L);
+
+        lua_createtable(L, 0, 5);
+        Eluna::Push(L, E->GetInstanceDataCount());
+        lua_setfield(L, -2, "instances");
+        Eluna::Push(L, E->GetContinentDataCount());
+        lua_setfield(L, -2, "continents");
+        Eluna::Push(L, E->GetDirtyDataCount());
+        lua_setfield(L, -2, "dirty");
+        Eluna::Push(L, E->GetInstanceDataCreated());
+        lua_setfield(L, -2, "created");
+        Eluna::Push(L, E->GetInstanceDataFreed());
+        lua_setfield(L, -2, "freed");
+        return 1;
+    }
+
+    /**
+     * Runs `function` on a worker thread and passes its return values to `callback` on a later world update.
+     *
+     * Workers run in their own sandboxed Lua states without any game bindings, so the function must only do pure Lua work.
+     * The function and arguments are copied to the worker, including the upvalues of the function.
+     * Only nil, booleans, numbers, strings, tables and Lua functions can be passed and returned.
+     *
+     * When the function succeeds, the parameters `(true, ...)` are passed to the callback, where `...` are the returned values.
+     * On error, the parameters `(false, errmsg)` are passed to it instead.
+     * A function that runs longer than `Eluna.AsyncTimeLimit` milliseconds fails with an error.
+     *
+     * Returns false without calling the callback when there are no workers (`Eluna.AsyncWorkers = 0`)
+     * or `Eluna.AsyncQueueSize` jobs are already waiting.
+     *
+     *     RunAsync(function(t) table.sort(t) return t[1] end, {3, 1, 2}, function(ok, lowest) print(ok, lowest) end)
+     *
+     * @proto queued = (function, callback)
+     * @proto queued = (function, ..., callback)
+     * @param function function : the function to run on a worker
+     * @param ... : arguments to pass to the function
+     * @param function callback : function called with the results on world update
+     * @return bool queued : true if the function was queued to run
+     */
+    int RunAsync(lua_State* L)
+    {
+        int top = lua_gettop(L);
+        luaL_checktype(L, 1, LUA_TFUNCTION);
+        luaL_checktype(L, top > 1 ? top : 2, LUA_TFUNCTION);
+
+        // Pack the call as { n = argc, function, args... }
+        int argc = top - 2;
+        lua_createtable(L, argc + 1, 1);
+        for (int i = 1; i <= argc + 1; ++i)
+        {
+            lua_pushvalue(L, i);
+            lua_rawseti(L, -2, i);
+        }
+        Eluna::Push(L, argc);
+        lua_setfield(L, -2, "n");
+
+        lua_pushcfunction(L, mar_encode);
+        lua_insert(L, -2);
+        lua_call(L, 1, 1);
+
+        size_t len;
+        const char* buf = lua_tolstring(L, -1, &len);
+        std::string data(buf, len);
+        lua_pop(L, 1);
+
+        lua_pushvalue(L, top);
+        int functionRef = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (functionRef == LUA_REFNIL || functionRef == LUA_NOREF)
+            return luaL_argerror(L, top, "unable to make a ref to function");
+
+        bool queued = Eluna::GetEluna(L)->workerPool->Queue(functionRef, data);
+        if (!queued)
+            luaL_unref(L, LUA_REGISTRYINDEX, functionRef);
+
+        Eluna::Push(L, queued);
+        return 1;
+    }
+
     /**
      * Performs an in-game spawn and returns the [Creature] or [GameObject] spawned.
      *
@@ -2950,6 +3531,7 @@ namespace LuaGlobalFunctions
         { "GetPlayerByName", &LuaGlobalFunctions::GetPlayerByName },
         { "GetGameTime", &LuaGlobalFunctions::GetGameTime },
         { "GetPlayersInWorld", &LuaGlobalFunctions::GetPlayersInWorld },
+        { "GetUnitSnapshot", &LuaGlobalFunctions::GetUnitSnapshot },
         { "GetGuildByName", &LuaGlobalFunctions::GetGuildByName },
         { "GetGuildByLeaderGUID", &LuaGlobalFunctions::GetGuildByLeaderGUID },
         { "GetPlayerCount", &LuaGlobalFunctions::GetPlayerCount },
@@ -2985,6 +3567,7 @@ namespace LuaGlobalFunctions
 
         // Other
         { "ReloadEluna", &LuaGlobalFunctions::ReloadEluna },
+        { "GetScriptLoadStats", &LuaGlobalFunctions::GetScriptLoadStats },
         { "RunCommand", &LuaGlobalFunctions::RunCommand },
         { "SendWorldMessage", &LuaGlobalFunctions::SendWorldMessage },
         { "WorldDBQuery", &LuaGlobalFunctions::WorldDBQuery },
@@ -2993,9 +3576,24 @@ namespace LuaGlobalFunctions
         { "CharDBExecute", &LuaGlobalFunctions::CharDBExecute },
         { "AuthDBQuery", &LuaGlobalFunctions::AuthDBQuery },
         { "AuthDBExecute", &LuaGlobalFunctions::AuthDBExecute },
+        { "WorldDBQueryAsync", &LuaGlobalFunctions::WorldDBQueryAsync },
+        { "CharDBQueryAsync", &LuaGlobalFunctions::CharDBQueryAsync },
+        { "AuthDBQueryAsync", &LuaGlobalFunctions::AuthDBQueryAsync },
+        { "GetDBQueryStats", &LuaGlobalFunctions::GetDBQueryStats },
+        { "CreateStatement", &LuaGlobalFunctions::CreateStatement },
+        { "GetSqlTemplateCacheStats", &LuaGlobalFunctions::GetSqlTemplateCacheStats },
+        { "WorldDBTransaction", &LuaGlobalFunctions::WorldDBTransaction },
+        { "CharDBTransaction", &LuaGlobalFunctions::CharDBTransaction },
+        { "AuthDBTransaction", &LuaGlobalFunctions::AuthDBTransaction },
         { "CreateLuaEvent", &LuaGlobalFunctions::CreateLuaEvent },
         { "RemoveEventById", &LuaGlobalFunctions::RemoveEventById },
         { "RemoveEvents", &LuaGlobalFunctions::RemoveEvents },
+        { "RegisterChannelHandler", &LuaGlobalFunctions::RegisterChannelHandler },
+        { "ClearChannelHandlers", &LuaGlobalFunctions::ClearChannelHandlers },
+        { "SendChannelMessage", &LuaGlobalFunctions::SendChannelMessage },
+        { "GetChannelStats", &LuaGlobalFunctions::GetChannelStats },
+        { "GetInstanceDataStats", &LuaGlobalFunctions::GetInstanceDataStats },
+        { "RunAsync", &LuaGlobalFunctions::RunAsync },
         { "PerformIngameSpawn", &LuaGlobalFunctions::PerformIngameSpawn },
         { "CreatePacket", &LuaGlobalFunctions::CreatePacket },
         { "AddVendorItem", &LuaGlobalFunctions::AddVendorItem },
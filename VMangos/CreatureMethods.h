@@ -798,10 +798,15 @@ namespace LuaCreature
     /**
      * Returns all [Unit]s in the [Creature]'s threat list.
      *
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     * @param uint32 maxResults = 0 : the most targets to return, 0 for no limit
+     *
      * @return table targets
      */
     int GetAITargets(lua_State* L, Creature* creature)
     {
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 3, 0);
+
 #if defined(TRINITY)
         auto const& threatlist = creature->GetThreatManager().GetSortedThreatList();
 #elif defined(AZEROTHCORE)
@@ -813,11 +818,10 @@ namespace LuaCreature
 #endif
 
 #if defined(TRINITY)
-        lua_createtable(L, creature->GetThreatManager().GetThreatListSize(), 0);
+        int tbl = Eluna::PushResultTable(L, 2, creature->GetThreatManager().GetThreatListSize());
 #else
-        lua_createtable(L, threatlist.size(), 0);
+        int tbl = Eluna::PushResultTable(L, 2, threatlist.size());
 #endif
-        int tbl = lua_gettop(L);
         uint32 i = 0;
 #if defined(TRINITY)
         for (ThreatReference const* itr : threatlist)
@@ -834,8 +838,11 @@ namespace LuaCreature
                 continue;
             Eluna::Push(L, target);
             lua_rawseti(L, tbl, ++i);
+            if (i == maxResults)
+                break;
         }
 
+        Eluna::TrimResultTable(L, tbl, i);
         lua_settop(L, tbl);
         return 1;
     }
@@ -289,6 +289,9 @@ namespace LuaMap
      * The instance must be scripted using Eluna for this to succeed.
      * If the instance is scripted in C++ this will return `nil`.
      *
+     * Changes to the table are saved when it was last passed to Lua by this method or an
+     *   instance hook. Get it again instead of keeping it for later, such as in a timed event.
+     *
      * @return table instance_data : instance data table, or `nil`
      */
     int GetInstanceData(lua_State* L, Map* map)
@@ -339,14 +342,16 @@ namespace LuaMap
     *     };
     *
     * @param [TeamId] team : optional check team of the [Player], Alliance, Horde or Neutral (All)
+    * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+    * @param uint32 maxResults = 0 : the most players to return, 0 for no limit
     * @return table mapPlayers
     */
     int GetPlayers(lua_State* L, Map* map)
     {
         uint32 team = Eluna::CHECKVAL<uint32>(L, 2, TEAM_NEUTRAL);
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 4, 0);
 
-        lua_newtable(L);
-        int tbl = lua_gettop(L);
+        int tbl = Eluna::PushResultTable(L, 3, 0);
         uint32 i = 0;
 
         Map::PlayerList const& players = map->GetPlayers();
@@ -363,9 +368,12 @@ namespace LuaMap
             {
                 Eluna::Push(L, player);
                 lua_rawseti(L, tbl, ++i);
+                if (i == maxResults)
+                    break;
             }
         }
 
+        Eluna::TrimResultTable(L, tbl, i);
         lua_settop(L, tbl);
         return 1;
     }
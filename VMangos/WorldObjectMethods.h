@@ -257,12 +257,33 @@ namespace LuaWorldObject
         return 1;
     }
 
+    /*
+     * Pushes the table at `index` filled with `objects`, or a new table if there is none.
+     */
+    static int PushObjectTable(lua_State* L, int index, std::vector<WorldObject*> const& objects)
+    {
+        int tbl = Eluna::PushResultTable(L, index, objects.size());
+        uint32 i = 0;
+
+        for (std::vector<WorldObject*>::const_iterator it = objects.begin(); it != objects.end(); ++it)
+        {
+            Eluna::Push(L, *it);
+            lua_rawseti(L, tbl, ++i);
+        }
+
+        Eluna::TrimResultTable(L, tbl, i);
+        lua_settop(L, tbl);
+        return 1;
+    }
+
     /**
      * Returns a table of [Player] objects in sight of the [WorldObject] or within the given range
      *
      * @param float range = 533.33333 : optionally set range. Default range is grid size
      * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
      * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     * @param uint32 maxResults = 0 : the most objects to return, 0 for no limit. The search stops once this many were found
      *
      * @return table playersInRange : table of [Player]s
      */
@@ -271,32 +292,16 @@ namespace LuaWorldObject
         float range = Eluna::CHECKVAL<float>(L, 2, SIZE_OF_GRIDS);
         uint32 hostile = Eluna::CHECKVAL<uint32>(L, 3, 0);
         uint32 dead = Eluna::CHECKVAL<uint32>(L, 4, 1);
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 6, 0);
 
-        std::list<Player*> list;
+        std::vector<WorldObject*> objects;
         ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_PLAYER, 0, hostile, dead);
-#ifdef TRINITY
-        Trinity::PlayerListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
-        Cell::VisitAllObjects(obj, searcher, range);
-#elif AZEROTHCORE
-        Acore::PlayerListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
-        Cell::VisitAllObjects(obj, searcher, range);
-#else
-        MaNGOS::PlayerListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(list, checker);
+        ElunaUtil::WorldObjectCollector collector(checker, objects, maxResults);
+        Unit* target = NULL;
+        MaNGOS::UnitSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
         Cell::VisitWorldObjects(obj, searcher, range);
-#endif
-
-        lua_createtable(L, list.size(), 0);
-        int tbl = lua_gettop(L);
-        uint32 i = 0;
-
-        for (std::list<Player*>::const_iterator it = list.begin(); it != list.end(); ++it)
-        {
-            Eluna::Push(L, *it);
-            lua_rawseti(L, tbl, ++i);
-        }
 
-        lua_settop(L, tbl);
-        return 1;
+        return PushObjectTable(L, 5, objects);
     }
 
     /**
@@ -306,6 +311,8 @@ namespace LuaWorldObject
      * @param uint32 entryId = 0 : optionally set entry ID of creatures to find
      * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
      * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     * @param uint32 maxResults = 0 : the most objects to return, 0 for no limit. The search stops once this many were found
      *
      * @return table creaturesInRange : table of [Creature]s
      */
@@ -315,32 +322,24 @@ namespace LuaWorldObject
         uint32 entry = Eluna::CHECKVAL<uint32>(L, 3, 0);
         uint32 hostile = Eluna::CHECKVAL<uint32>(L, 4, 0);
         uint32 dead = Eluna::CHECKVAL<uint32>(L, 5, 1);
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 7, 0);
 
-        std::list<Creature*> list;
+        std::vector<WorldObject*> objects;
         ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_UNIT, entry, hostile, dead);
+        ElunaUtil::WorldObjectCollector collector(checker, objects, maxResults);
+        Creature* target = NULL;
 #ifdef TRINITY
-        Trinity::CreatureListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
+        Trinity::CreatureSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
-#elif defined AZEROTHCORE
-        Acore::CreatureListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
+#elif AZEROTHCORE
+        Acore::CreatureSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
 #else
-        MaNGOS::CreatureListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(list, checker);
+        MaNGOS::CreatureSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
         Cell::VisitGridObjects(obj, searcher, range);
 #endif
 
-        lua_createtable(L, list.size(), 0);
-        int tbl = lua_gettop(L);
-        uint32 i = 0;
-
-        for (std::list<Creature*>::const_iterator it = list.begin(); it != list.end(); ++it)
-        {
-            Eluna::Push(L, *it);
-            lua_rawseti(L, tbl, ++i);
-        }
-
-        lua_settop(L, tbl);
-        return 1;
+        return PushObjectTable(L, 6, objects);
     }
 
     /**
@@ -349,6 +348,8 @@ namespace LuaWorldObject
      * @param float range = 533.33333 : optionally set range. Default range is grid size
      * @param uint32 entryId = 0 : optionally set entry ID of game objects to find
      * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     * @param uint32 maxResults = 0 : the most objects to return, 0 for no limit. The search stops once this many were found
      *
      * @return table gameObjectsInRange : table of [GameObject]s
      */
@@ -357,32 +358,141 @@ namespace LuaWorldObject
         float range = Eluna::CHECKVAL<float>(L, 2, SIZE_OF_GRIDS);
         uint32 entry = Eluna::CHECKVAL<uint32>(L, 3, 0);
         uint32 hostile = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 6, 0);
 
-        std::list<GameObject*> list;
+        std::vector<WorldObject*> objects;
         ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_GAMEOBJECT, entry, hostile);
+        ElunaUtil::WorldObjectCollector collector(checker, objects, maxResults);
+        GameObject* target = NULL;
 #ifdef TRINITY
-        Trinity::GameObjectListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
+        Trinity::GameObjectSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
 #elif AZEROTHCORE
-        Acore::GameObjectListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
+        Acore::GameObjectSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
 #else
-        MaNGOS::GameObjectListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(list, checker);
+        MaNGOS::GameObjectSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
         Cell::VisitGridObjects(obj, searcher, range);
 #endif
 
-        lua_createtable(L, list.size(), 0);
-        int tbl = lua_gettop(L);
-        uint32 i = 0;
+        return PushObjectTable(L, 5, objects);
+    }
 
-        for (std::list<GameObject*>::const_iterator it = list.begin(); it != list.end(); ++it)
-        {
-            Eluna::Push(L, *it);
-            lua_rawseti(L, tbl, ++i);
-        }
+    /**
+     * Returns a table of the `count` [Player] objects nearest to the [WorldObject], within the given range
+     *
+     * The table is sorted by distance, nearest first. Only the nearest objects are kept
+     * while searching, so this is cheaper than sorting the result of a range query.
+     *
+     * @param uint32 count : the most objects to return
+     * @param float range = 533.33333 : optionally set range. Default range is grid size
+     * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     *
+     * @return table nearestPlayers : table of [Player]s
+     */
+    int GetNearestPlayers(lua_State* L, WorldObject* obj)
+    {
+        uint32 count = Eluna::CHECKVAL<uint32>(L, 2);
+        float range = Eluna::CHECKVAL<float>(L, 3, SIZE_OF_GRIDS);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 dead = Eluna::CHECKVAL<uint32>(L, 5, 1);
 
-        lua_settop(L, tbl);
-        return 1;
+        std::vector<WorldObject*> objects;
+        ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_PLAYER, 0, hostile, dead);
+        ElunaUtil::WorldObjectNearestCollector collector(checker, count);
+        Unit* target = NULL;
+        MaNGOS::UnitLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(target, collector);
+        Cell::VisitWorldObjects(obj, searcher, range);
+
+        collector.GetObjects(objects);
+
+        return PushObjectTable(L, 6, objects);
+    }
+
+    /**
+     * Returns a table of the `count` [Creature] objects nearest to the [WorldObject], within the given range and/or with a specific entry ID
+     *
+     * The table is sorted by distance, nearest first. Only the nearest objects are kept
+     * while searching, so this is cheaper than sorting the result of a range query.
+     *
+     * @param uint32 count : the most objects to return
+     * @param float range = 533.33333 : optionally set range. Default range is grid size
+     * @param uint32 entryId = 0 : optionally set entry ID of creatures to find
+     * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     *
+     * @return table nearestCreatures : table of [Creature]s
+     */
+    int GetNearestCreatures(lua_State* L, WorldObject* obj)
+    {
+        uint32 count = Eluna::CHECKVAL<uint32>(L, 2);
+        float range = Eluna::CHECKVAL<float>(L, 3, SIZE_OF_GRIDS);
+        uint32 entry = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 5, 0);
+        uint32 dead = Eluna::CHECKVAL<uint32>(L, 6, 1);
+
+        std::vector<WorldObject*> objects;
+        ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_UNIT, entry, hostile, dead);
+        ElunaUtil::WorldObjectNearestCollector collector(checker, count);
+        Creature* target = NULL;
+#ifdef TRINITY
+        Trinity::CreatureLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(obj, target, collector);
+        Cell::VisitAllObjects(obj, searcher, range);
+#elif AZEROTHCORE
+        Acore::CreatureLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(obj, target, collector);
+        Cell::VisitAllObjects(obj, searcher, range);
+#else
+        MaNGOS::CreatureLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(target, collector);
+        Cell::VisitGridObjects(obj, searcher, range);
+#endif
+
+        collector.GetObjects(objects);
+
+        return PushObjectTable(L, 7, objects);
+    }
+
+    /**
+     * Returns a table of the `count` [GameObject] objects nearest to the [WorldObject], within the given range and/or with a specific entry ID
+     *
+     * The table is sorted by distance, nearest first. Only the nearest objects are kept
+     * while searching, so this is cheaper than sorting the result of a range query.
+     *
+     * @param uint32 count : the most objects to return
+     * @param float range = 533.33333 : optionally set range. Default range is grid size
+     * @param uint32 entryId = 0 : optionally set entry ID of game objects to find
+     * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     *
+     * @return table nearestGameObjects : table of [GameObject]s
+     */
+    int GetNearestGameObjects(lua_State* L, WorldObject* obj)
+    {
+        uint32 count = Eluna::CHECKVAL<uint32>(L, 2);
+        float range = Eluna::CHECKVAL<float>(L, 3, SIZE_OF_GRIDS);
+        uint32 entry = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 5, 0);
+
+        std::vector<WorldObject*> objects;
+        ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_GAMEOBJECT, entry, hostile);
+        ElunaUtil::WorldObjectNearestCollector collector(checker, count);
+        GameObject* target = NULL;
+#ifdef TRINITY
+        Trinity::GameObjectLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(obj, target, collector);
+        Cell::VisitAllObjects(obj, searcher, range);
+#elif AZEROTHCORE
+        Acore::GameObjectLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(obj, target, collector);
+        Cell::VisitAllObjects(obj, searcher, range);
+#else
+        MaNGOS::GameObjectLastSearcher<ElunaUtil::WorldObjectNearestCollector> searcher(target, collector);
+        Cell::VisitGridObjects(obj, searcher, range);
+#endif
+
+        collector.GetObjects(objects);
+
+        return PushObjectTable(L, 6, objects);
     }
 
     /**
@@ -434,6 +544,8 @@ namespace LuaWorldObject
      * @param uint32 entry = 0 : the entry of the [WorldObject], 0 will be ingored
      * @param uint32 hostile = 0 : specifies whether the [WorldObject] needs to be 1 hostile, 2 friendly or 0 either
      * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     * @param table results = nil : table to fill and return instead of a new table, any further entries in it are removed
+     * @param uint32 maxResults = 0 : the most objects to return, 0 for no limit. The search stops once this many were found
      *
      * @return table worldObjectList : table of [WorldObject]s
      */
@@ -444,34 +556,233 @@ namespace LuaWorldObject
         uint32 entry = Eluna::CHECKVAL<uint32>(L, 4, 0);
         uint32 hostile = Eluna::CHECKVAL<uint32>(L, 5, 0); // 0 none, 1 hostile, 2 friendly
         uint32 dead = Eluna::CHECKVAL<uint32>(L, 6, 1); // 0 both, 1 alive, 2 dead
+        uint32 maxResults = Eluna::CHECKVAL<uint32>(L, 8, 0);
 
-        float x, y, z;
-        obj->GetPosition(x, y, z);
+        std::vector<WorldObject*> objects;
         ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, type, entry, hostile, dead);
-
-        std::list<WorldObject*> list;
+        ElunaUtil::WorldObjectCollector collector(checker, objects, maxResults);
+        WorldObject* target = NULL;
 #ifdef TRINITY
-        Trinity::WorldObjectListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
+        Trinity::WorldObjectSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
 #elif AZEROTHCORE
-        Acore::WorldObjectListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(obj, list, checker);
+        Acore::WorldObjectSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
 #else
-        MaNGOS::WorldObjectListSearcher<ElunaUtil::WorldObjectInRangeCheck> searcher(list, checker);
+        MaNGOS::WorldObjectSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
         Cell::VisitAllObjects(obj, searcher, range);
 #endif
 
-        lua_createtable(L, list.size(), 0);
-        int tbl = lua_gettop(L);
-        uint32 i = 0;
+        return PushObjectTable(L, 7, objects);
+    }
 
-        for (std::list<WorldObject*>::const_iterator it = list.begin(); it != list.end(); ++it)
+    /*
+     * Calls the function at `fn` with each of `objects` until it returns `false`.
+     * Returns the amount of calls, or -1 with the error on the stack if a call failed.
+     */
+    static int CallForEachObject(lua_State* L, int fn, std::vector<WorldObject*> const& objects)
+    {
+        int count = 0;
+        for (std::vector<WorldObject*>::const_iterator it = objects.begin(); it != objects.end(); ++it)
         {
+            lua_pushvalue(L, fn);
             Eluna::Push(L, *it);
-            lua_rawseti(L, tbl, ++i);
+            if (lua_pcall(L, 1, 1, 0) != 0)
+                return -1;
+
+            ++count;
+            bool stop = lua_isboolean(L, -1) && !lua_toboolean(L, -1);
+            lua_pop(L, 1);
+            if (stop)
+                break;
         }
+        return count;
+    }
 
-        lua_settop(L, tbl);
+    /**
+     * Calls `function` with each [Player] in sight of the [WorldObject] or within the given range
+     *
+     * The objects are found first and `function` is called after the search, with the object as its only argument.
+     * No table is created. Returning `false` from `function` stops the iteration.
+     *
+     * @param float range : the range to search in
+     * @param function function : the function to call with each [Player]
+     * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     *
+     * @return uint32 count : the amount of objects `function` was called for
+     */
+    int ForEachPlayerInRange(lua_State* L, WorldObject* obj)
+    {
+        float range = Eluna::CHECKVAL<float>(L, 2);
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 dead = Eluna::CHECKVAL<uint32>(L, 5, 1);
+
+        int count;
+        {
+            std::vector<WorldObject*> objects;
+            ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_PLAYER, 0, hostile, dead);
+            ElunaUtil::WorldObjectCollector collector(checker, objects);
+            Unit* target = NULL;
+            MaNGOS::UnitLastSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
+            Cell::VisitWorldObjects(obj, searcher, range);
+
+            count = CallForEachObject(L, 3, objects);
+        }
+
+        if (count < 0)
+            return lua_error(L);
+
+        Eluna::Push(L, count);
+        return 1;
+    }
+
+    /**
+     * Calls `function` with each [Creature] in sight of the [WorldObject] or within the given range and/or with a specific entry ID
+     *
+     * The objects are found first and `function` is called after the search, with the object as its only argument.
+     * No table is created. Returning `false` from `function` stops the iteration.
+     *
+     * @param float range : the range to search in
+     * @param function function : the function to call with each [Creature]
+     * @param uint32 entryId = 0 : optionally set entry ID of creatures to find
+     * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     *
+     * @return uint32 count : the amount of objects `function` was called for
+     */
+    int ForEachCreatureInRange(lua_State* L, WorldObject* obj)
+    {
+        float range = Eluna::CHECKVAL<float>(L, 2);
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+        uint32 entry = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 5, 0);
+        uint32 dead = Eluna::CHECKVAL<uint32>(L, 6, 1);
+
+        int count;
+        {
+            std::vector<WorldObject*> objects;
+            ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_UNIT, entry, hostile, dead);
+            ElunaUtil::WorldObjectCollector collector(checker, objects);
+            Creature* target = NULL;
+#ifdef TRINITY
+            Trinity::CreatureLastSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#elif AZEROTHCORE
+            Acore::CreatureLastSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#else
+            MaNGOS::CreatureLastSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
+            Cell::VisitGridObjects(obj, searcher, range);
+#endif
+
+            count = CallForEachObject(L, 3, objects);
+        }
+
+        if (count < 0)
+            return lua_error(L);
+
+        Eluna::Push(L, count);
+        return 1;
+    }
+
+    /**
+     * Calls `function` with each [GameObject] in sight of the [WorldObject] or within the given range and/or with a specific entry ID
+     *
+     * The objects are found first and `function` is called after the search, with the object as its only argument.
+     * No table is created. Returning `false` from `function` stops the iteration.
+     *
+     * @param float range : the range to search in
+     * @param function function : the function to call with each [GameObject]
+     * @param uint32 entryId = 0 : optionally set entry ID of game objects to find
+     * @param uint32 hostile = 0 : 0 both, 1 hostile, 2 friendly
+     *
+     * @return uint32 count : the amount of objects `function` was called for
+     */
+    int ForEachGameObjectInRange(lua_State* L, WorldObject* obj)
+    {
+        float range = Eluna::CHECKVAL<float>(L, 2);
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+        uint32 entry = Eluna::CHECKVAL<uint32>(L, 4, 0);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 5, 0);
+
+        int count;
+        {
+            std::vector<WorldObject*> objects;
+            ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, TYPEMASK_GAMEOBJECT, entry, hostile);
+            ElunaUtil::WorldObjectCollector collector(checker, objects);
+            GameObject* target = NULL;
+#ifdef TRINITY
+            Trinity::GameObjectLastSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#elif AZEROTHCORE
+            Acore::GameObjectLastSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#else
+            MaNGOS::GameObjectLastSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
+            Cell::VisitGridObjects(obj, searcher, range);
+#endif
+
+            count = CallForEachObject(L, 3, objects);
+        }
+
+        if (count < 0)
+            return lua_error(L);
+
+        Eluna::Push(L, count);
+        return 1;
+    }
+
+    /**
+     * Calls `function` with each [WorldObject] in sight of the [WorldObject].
+     * The distance, type, entry and hostility requirements the [WorldObject] must match can be passed.
+     *
+     * The objects are found first and `function` is called after the search, with the object as its only argument.
+     * No table is created. Returning `false` from `function` stops the iteration.
+     *
+     * @param float range : the range to search in
+     * @param function function : the function to call with each [WorldObject]
+     * @param [TypeMask] type = 0 : the [TypeMask] that the [WorldObject] must be. This can contain multiple types. 0 will be ingored
+     * @param uint32 entry = 0 : the entry of the [WorldObject], 0 will be ingored
+     * @param uint32 hostile = 0 : specifies whether the [WorldObject] needs to be 1 hostile, 2 friendly or 0 either
+     * @param uint32 dead = 1 : 0 both, 1 alive, 2 dead
+     *
+     * @return uint32 count : the amount of objects `function` was called for
+     */
+    int ForEachNearObject(lua_State* L, WorldObject* obj)
+    {
+        float range = Eluna::CHECKVAL<float>(L, 2);
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+        uint16 type = Eluna::CHECKVAL<uint16>(L, 4, 0); // TypeMask
+        uint32 entry = Eluna::CHECKVAL<uint32>(L, 5, 0);
+        uint32 hostile = Eluna::CHECKVAL<uint32>(L, 6, 0); // 0 none, 1 hostile, 2 friendly
+        uint32 dead = Eluna::CHECKVAL<uint32>(L, 7, 1); // 0 both, 1 alive, 2 dead
+
+        int count;
+        {
+            std::vector<WorldObject*> objects;
+            ElunaUtil::WorldObjectInRangeCheck checker(false, obj, range, type, entry, hostile, dead);
+            ElunaUtil::WorldObjectCollector collector(checker, objects);
+            WorldObject* target = NULL;
+#ifdef TRINITY
+            Trinity::WorldObjectLastSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#elif AZEROTHCORE
+            Acore::WorldObjectLastSearcher<ElunaUtil::WorldObjectCollector> searcher(obj, target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#else
+            MaNGOS::WorldObjectLastSearcher<ElunaUtil::WorldObjectCollector> searcher(target, collector);
+            Cell::VisitAllObjects(obj, searcher, range);
+#endif
+
+            count = CallForEachObject(L, 3, objects);
+        }
+
+        if (count < 0)
+            return lua_error(L);
+
+        Eluna::Push(L, count);
         return 1;
     }
 
@@ -1192,8 +1503,15 @@ namespace LuaWorldObject
         { "GetNearestPlayer", &LuaWorldObject::GetNearestPlayer },
         { "GetNearestGameObject", &LuaWorldObject::GetNearestGameObject },
         { "GetNearestCreature", &LuaWorldObject::GetNearestCreature },
+        { "GetNearestPlayers", &LuaWorldObject::GetNearestPlayers },
+        { "GetNearestCreatures", &LuaWorldObject::GetNearestCreatures },
+        { "GetNearestGameObjects", &LuaWorldObject::GetNearestGameObjects },
         { "GetNearObject", &LuaWorldObject::GetNearObject },
         { "GetNearObjects", &LuaWorldObject::GetNearObjects },
+        { "ForEachPlayerInRange", &LuaWorldObject::ForEachPlayerInRange },
+        { "ForEachCreatureInRange", &LuaWorldObject::ForEachCreatureInRange },
+        { "ForEachGameObjectInRange", &LuaWorldObject::ForEachGameObjectInRange },
+        { "ForEachNearObject", &LuaWorldObject::ForEachNearObject },
         { "GetDistance", &LuaWorldObject::GetDistance },
         { "GetExactDistance", &LuaWorldObject::GetExactDistance },
         { "GetDistance2d", &LuaWorldObject::GetDistance2d },
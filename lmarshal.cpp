@@ -31,6 +31,7 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <cstdint>
 #include "ElunaCompat.h"
 
@@ -51,6 +52,36 @@ extern "C" {
 #define MAR_MAGIC 0x8f
 #define SEEN_IDX  3
 
+/*
+ * Compact format, MAR_MAGIC_COMPACT followed by MAR_COMPACT_VERSION.
+ *
+ * Every value starts with one of the MAR_C_* tags:
+ *   integral numbers are zig-zag varints, other numbers 8 byte lua_Numbers
+ *   strings are a varint length and the bytes, a repeated string is a
+ *     varint index into the strings seen so far
+ *   tables are a varint count N, values 1..N, then key/value pairs up to MAR_C_END
+ *   functions are a 4 byte length, the dump and a table body of upvalues
+ *   refs to tables and functions seen before are varint indexes like MAR_TREF
+ */
+#define MAR_MAGIC_COMPACT   0x90
+#define MAR_COMPACT_VERSION 1
+#define STRINGS_IDX 4
+
+enum {
+    MAR_C_NIL,
+    MAR_C_FALSE,
+    MAR_C_TRUE,
+    MAR_C_INT,
+    MAR_C_NUM,
+    MAR_C_STR,
+    MAR_C_STRREF,
+    MAR_C_TABLE,
+    MAR_C_REF,
+    MAR_C_FUNC,
+    MAR_C_PERSIST,
+    MAR_C_END
+};
+
 #define MAR_ENV_IDX_KEY  "E"
 #define MAR_NUPS_IDX_KEY "n"
 
@@ -98,6 +129,47 @@ static int buf_write(lua_State* L, const char* str, size_t len, mar_Buffer *buf)
     return 0;
 }
 
+/*
+ * mar_encode writes everything into a single buffer, which is kept per thread
+ *   and reused by the next call. Nested values are prefixed with their length,
+ *   so that field is reserved first and patched once the value was written.
+ *
+ * A call made while the buffer is taken, e.g. from a __persist hook, gets a new
+ *   buffer. Encoding runs in a protected call, so the buffer is handed back
+ *   before an error raised while encoding is passed on.
+ */
+#define MAR_SCRATCH_MAX (1024 * 1024) /* larger buffers are not kept */
+
+struct mar_Scratch {
+    mar_Buffer buf;
+
+    mar_Scratch() { buf.data = NULL; }
+    ~mar_Scratch() { free(buf.data); }
+};
+
+static thread_local mar_Scratch mar_scratch;
+
+static void buf_take_scratch(lua_State *L, mar_Buffer *buf)
+{
+    if (!mar_scratch.buf.data) {
+        buf_init(L, buf);
+        return;
+    }
+    *buf = mar_scratch.buf;
+    buf->seek = 0;
+    buf->head = 0;
+    mar_scratch.buf.data = NULL;
+}
+
+static void buf_return_scratch(lua_State *L, mar_Buffer *buf)
+{
+    if (mar_scratch.buf.data || buf->size > MAR_SCRATCH_MAX) {
+        buf_done(L, buf);
+        return;
+    }
+    mar_scratch.buf = *buf;
+}
+
 static const char* buf_read(lua_State* /*L*/, mar_Buffer *buf, size_t *len)
 {
     if (buf->seek < buf->head) {
@@ -109,10 +181,30 @@ static const char* buf_read(lua_State* /*L*/, mar_Buffer *buf, size_t *len)
     return NULL;
 }
 
+/* Reserves a length field in buf and returns its offset for buf_patch_len */
+static size_t buf_reserve_len(lua_State *L, mar_Buffer *buf)
+{
+    uint32_t placeholder = 0;
+    size_t pos = buf->head;
+    buf_write(L, (const char*)&placeholder, MAR_I32, buf);
+    return pos;
+}
+
+/* Sets the length field at pos to the length of everything written after it */
+static void buf_patch_len(lua_State *L, mar_Buffer *buf, size_t pos)
+{
+    size_t len = buf->head - pos - MAR_I32;
+    if (len > UINT32_MAX) luaL_error(L, "buffer too long");
+    uint32_t len32 = (uint32_t)len;
+    memcpy(&buf->data[pos], &len32, MAR_I32);
+}
+
 static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx)
 {
     size_t l;
     int val_type = lua_type(L, val);
+    /* each nesting level keeps a few values on the stack */
+    luaL_checkstack(L, 8, "table too deeply nested");
     lua_pushvalue(L, val);
 
     buf_write(L, (const char*)&val_type, MAR_CHR, buf);
@@ -135,6 +227,7 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
     }
     case LUA_TTABLE: {
         int tag, ref;
+        size_t len_pos;
         lua_pushvalue(L, -1);
         lua_rawget(L, SEEN_IDX);
         if (!lua_isnil(L, -1)) {
@@ -145,7 +238,6 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
             lua_pop(L, 1);
         }
         else {
-            mar_Buffer rec_buf;
             lua_pop(L, 1); /* pop nil */
             if (luaL_getmetafield(L, -1, "__persist")) {
                 tag = MAR_TUSR;
@@ -162,13 +254,10 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
                 lua_pushvalue(L, -2); /* callback */
                 lua_rawseti(L, -2, 1);
 
-                buf_init(L, &rec_buf);
-                mar_encode_table(L, &rec_buf, idx);
-
                 buf_write(L, (const char*)&tag, MAR_CHR, buf);
-                buf_write(L, (const char*)&rec_buf.head, MAR_I32, buf);
-                buf_write(L, rec_buf.data, rec_buf.head, buf);
-                buf_done(L, &rec_buf);
+                len_pos = buf_reserve_len(L, buf);
+                mar_encode_table(L, buf, idx);
+                buf_patch_len(L, buf, len_pos);
                 lua_pop(L, 1);
             }
             else {
@@ -178,15 +267,12 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
                 lua_pushinteger(L, (*idx)++);
                 lua_rawset(L, SEEN_IDX);
 
+                buf_write(L, (const char*)&tag, MAR_CHR, buf);
+                len_pos = buf_reserve_len(L, buf);
                 lua_pushvalue(L, -1);
-                buf_init(L, &rec_buf);
-                mar_encode_table(L, &rec_buf, idx);
+                mar_encode_table(L, buf, idx);
                 lua_pop(L, 1);
-
-                buf_write(L, (const char*)&tag, MAR_CHR, buf);
-                buf_write(L, (const char*)&rec_buf.head, MAR_I32, buf);
-                buf_write(L, rec_buf.data,rec_buf.head, buf);
-                buf_done(L, &rec_buf);
+                buf_patch_len(L, buf, len_pos);
             }
         }
         break;
@@ -203,7 +289,7 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
             lua_pop(L, 1);
         }
         else {
-            mar_Buffer rec_buf;
+            size_t len_pos;
             unsigned int i;
             lua_Debug ar;
             lua_pop(L, 1); /* pop nil */
@@ -218,15 +304,12 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
             lua_pushinteger(L, (*idx)++);
             lua_rawset(L, SEEN_IDX);
 
-            lua_pushvalue(L, -1);
-            buf_init(L, &rec_buf);
-            lua_dump(L, (lua_Writer)buf_write, &rec_buf);
-
             buf_write(L, (const char*)&tag, MAR_CHR, buf);
-            buf_write(L, (const char*)&rec_buf.head, MAR_I32, buf);
-            buf_write(L, rec_buf.data, rec_buf.head, buf);
-            buf_done(L, &rec_buf);
+            len_pos = buf_reserve_len(L, buf);
+            lua_pushvalue(L, -1);
+            lua_dump(L, (lua_Writer)buf_write, buf);
             lua_pop(L, 1);
+            buf_patch_len(L, buf, len_pos);
 
             lua_createtable(L, ar.nups, 0);
             for (i = 1; i <= ar.nups; i++) {
@@ -246,12 +329,9 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
             lua_pushnumber(L, ar.nups);
             lua_rawset(L, -3);
 
-            buf_init(L, &rec_buf);
-            mar_encode_table(L, &rec_buf, idx);
-
-            buf_write(L, (const char*)&rec_buf.head, MAR_I32, buf);
-            buf_write(L, rec_buf.data, rec_buf.head, buf);
-            buf_done(L, &rec_buf);
+            len_pos = buf_reserve_len(L, buf);
+            mar_encode_table(L, buf, idx);
+            buf_patch_len(L, buf, len_pos);
             lua_pop(L, 1);
         }
 
@@ -269,7 +349,7 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
             lua_pop(L, 1);
         }
         else {
-            mar_Buffer rec_buf;
+            size_t len_pos;
             lua_pop(L, 1); /* pop nil */
             if (luaL_getmetafield(L, -1, "__persist")) {
                 tag = MAR_TUSR;
@@ -288,13 +368,10 @@ static void mar_encode_value(lua_State *L, mar_Buffer *buf, int val, size_t *idx
                 lua_rawseti(L, -2, 1);
                 lua_remove(L, -2);
 
-                buf_init(L, &rec_buf);
-                mar_encode_table(L, &rec_buf, idx);
-
                 buf_write(L, (const char*)&tag, MAR_CHR, buf);
-                buf_write(L, (const char*)&rec_buf.head, MAR_I32, buf);
-		        buf_write(L, rec_buf.data, rec_buf.head, buf);
-		        buf_done(L, &rec_buf);
+                len_pos = buf_reserve_len(L, buf);
+                mar_encode_table(L, buf, idx);
+                buf_patch_len(L, buf, len_pos);
             }
             else {
                 luaL_error(L, "attempt to encode userdata (no __persist hook)");
@@ -321,6 +398,232 @@ static int mar_encode_table(lua_State *L, mar_Buffer *buf, size_t *idx)
     return 1;
 }
 
+typedef struct mar_Compact {
+    mar_Buffer *buf;
+    size_t *idx;
+    size_t strings;
+} mar_Compact;
+
+static void mar_compact_encode_body(lua_State *L, mar_Compact *c);
+
+static void buf_write_tag(lua_State *L, mar_Buffer *buf, int tag)
+{
+    char chr = (char)tag;
+    buf_write(L, &chr, MAR_CHR, buf);
+}
+
+static void buf_write_varint(lua_State *L, mar_Buffer *buf, uint64_t val)
+{
+    char bytes[10];
+    size_t n = 0;
+    do {
+        unsigned char byte = val & 0x7f;
+        val >>= 7;
+        if (val) byte |= 0x80;
+        bytes[n++] = (char)byte;
+    } while (val);
+    buf_write(L, bytes, n, buf);
+}
+
+/* Returns true and sets out if the number at val is an integer */
+static int mar_tointeger(lua_State *L, int val, int64_t *out)
+{
+#if LUA_VERSION_NUM >= 503
+    if (!lua_isinteger(L, val)) return 0;
+    *out = (int64_t)lua_tointeger(L, val);
+    return 1;
+#else
+    lua_Number num = lua_tonumber(L, val);
+    if (!(num >= -9223372036854775808.0 && num < 9223372036854775808.0)) return 0;
+    if (num != (lua_Number)(int64_t)num || (num == 0 && signbit(num))) return 0;
+    *out = (int64_t)num;
+    return 1;
+#endif
+}
+
+static void mar_compact_encode_value(lua_State *L, mar_Compact *c, int val)
+{
+    mar_Buffer *buf = c->buf;
+    luaL_checkstack(L, 8, "table too deeply nested");
+    lua_pushvalue(L, val);
+
+    switch (lua_type(L, -1)) {
+    case LUA_TNIL:
+        buf_write_tag(L, buf, MAR_C_NIL);
+        break;
+    case LUA_TBOOLEAN:
+        buf_write_tag(L, buf, lua_toboolean(L, -1) ? MAR_C_TRUE : MAR_C_FALSE);
+        break;
+    case LUA_TNUMBER: {
+        int64_t int_val;
+        if (mar_tointeger(L, -1, &int_val)) {
+            buf_write_tag(L, buf, MAR_C_INT);
+            buf_write_varint(L, buf, ((uint64_t)int_val << 1) ^ (uint64_t)(int_val >> 63));
+        }
+        else {
+            lua_Number num_val = lua_tonumber(L, -1);
+            buf_write_tag(L, buf, MAR_C_NUM);
+            buf_write(L, (const char*)&num_val, MAR_I64, buf);
+        }
+        break;
+    }
+    case LUA_TSTRING: {
+        size_t l;
+        lua_pushvalue(L, -1);
+        lua_rawget(L, STRINGS_IDX);
+        if (!lua_isnil(L, -1)) {
+            buf_write_tag(L, buf, MAR_C_STRREF);
+            buf_write_varint(L, buf, (uint64_t)lua_tointeger(L, -1));
+            lua_pop(L, 1);
+        }
+        else {
+            const char *str_val;
+            lua_pop(L, 1);
+            str_val = lua_tolstring(L, -1, &l);
+            buf_write_tag(L, buf, MAR_C_STR);
+            buf_write_varint(L, buf, l);
+            buf_write(L, str_val, l, buf);
+
+            lua_pushvalue(L, -1);
+            lua_pushinteger(L, (lua_Integer)++c->strings);
+            lua_rawset(L, STRINGS_IDX);
+        }
+        break;
+    }
+    case LUA_TTABLE:
+    case LUA_TUSERDATA: {
+        int is_table = lua_istable(L, -1);
+        lua_pushvalue(L, -1);
+        lua_rawget(L, SEEN_IDX);
+        if (!lua_isnil(L, -1)) {
+            buf_write_tag(L, buf, MAR_C_REF);
+            buf_write_varint(L, buf, (uint64_t)lua_tointeger(L, -1));
+            lua_pop(L, 1);
+        }
+        else if (lua_pop(L, 1), luaL_getmetafield(L, -1, "__persist")) {
+            lua_pushvalue(L, -2); /* self */
+            lua_call(L, 1, 1);
+            if (!lua_isfunction(L, -1)) {
+                luaL_error(L, "__persist must return a function");
+            }
+            lua_newtable(L);
+            lua_pushvalue(L, -2); /* callback */
+            lua_rawseti(L, -2, 1);
+            lua_remove(L, -2);
+
+            buf_write_tag(L, buf, MAR_C_PERSIST);
+            mar_compact_encode_body(L, c);
+            lua_pop(L, 1);
+
+            /* the decoder only has the value once the callback ran */
+            lua_pushvalue(L, -1);
+            lua_pushinteger(L, (lua_Integer)(*c->idx)++);
+            lua_rawset(L, SEEN_IDX);
+        }
+        else if (is_table) {
+            lua_pushvalue(L, -1);
+            lua_pushinteger(L, (lua_Integer)(*c->idx)++);
+            lua_rawset(L, SEEN_IDX);
+
+            buf_write_tag(L, buf, MAR_C_TABLE);
+            mar_compact_encode_body(L, c);
+        }
+        else {
+            luaL_error(L, "attempt to encode userdata (no __persist hook)");
+        }
+        break;
+    }
+    case LUA_TFUNCTION: {
+        lua_pushvalue(L, -1);
+        lua_rawget(L, SEEN_IDX);
+        if (!lua_isnil(L, -1)) {
+            buf_write_tag(L, buf, MAR_C_REF);
+            buf_write_varint(L, buf, (uint64_t)lua_tointeger(L, -1));
+            lua_pop(L, 1);
+        }
+        else {
+            size_t len_pos;
+            unsigned int i;
+            lua_Debug ar;
+            lua_pop(L, 1); /* pop nil */
+
+            lua_pushvalue(L, -1);
+            lua_getinfo(L, ">nuS", &ar);
+            if (ar.what[0] != 'L') {
+                luaL_error(L, "attempt to persist a C function '%s'", ar.name);
+            }
+            lua_pushvalue(L, -1);
+            lua_pushinteger(L, (lua_Integer)(*c->idx)++);
+            lua_rawset(L, SEEN_IDX);
+
+            buf_write_tag(L, buf, MAR_C_FUNC);
+            len_pos = buf_reserve_len(L, buf);
+            lua_pushvalue(L, -1);
+            lua_dump(L, (lua_Writer)buf_write, buf);
+            lua_pop(L, 1);
+            buf_patch_len(L, buf, len_pos);
+
+            lua_createtable(L, ar.nups, 0);
+            for (i = 1; i <= ar.nups; i++) {
+                const char* upvalue_name = lua_getupvalue(L, -2, i);
+                if (strcmp("_ENV", upvalue_name) == 0) {
+                    lua_pop(L, 1);
+                    // Mark where _ENV is expected.
+                    lua_pushstring(L, MAR_ENV_IDX_KEY);
+                    lua_pushinteger(L, i);
+                    lua_rawset(L, -3);
+                }
+                else {
+                    lua_rawseti(L, -2, i);
+                }
+            }
+            lua_pushstring(L, MAR_NUPS_IDX_KEY);
+            lua_pushnumber(L, ar.nups);
+            lua_rawset(L, -3);
+
+            mar_compact_encode_body(L, c);
+            lua_pop(L, 1);
+        }
+        break;
+    }
+    default:
+        luaL_error(L, "invalid value type (%s)", luaL_typename(L, -1));
+    }
+    lua_pop(L, 1);
+}
+
+/* Returns true if the key at key is an integer from 1 to n */
+static int mar_is_array_key(lua_State *L, int key, size_t n)
+{
+    int64_t int_key;
+    if (lua_type(L, key) != LUA_TNUMBER || !mar_tointeger(L, key, &int_key)) return 0;
+    return int_key >= 1 && (uint64_t)int_key <= n;
+}
+
+/* Encodes the contents of the table on top of the stack */
+static void mar_compact_encode_body(lua_State *L, mar_Compact *c)
+{
+    size_t n = lua_rawlen(L, -1);
+    size_t i;
+
+    buf_write_varint(L, c->buf, n);
+    for (i = 1; i <= n; i++) {
+        lua_rawgeti(L, -1, i);
+        mar_compact_encode_value(L, c, -1);
+        lua_pop(L, 1);
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+        if (!mar_is_array_key(L, -2, n)) {
+            mar_compact_encode_value(L, c, -2);
+            mar_compact_encode_value(L, c, -1);
+        }
+        lua_pop(L, 1);
+    }
+    buf_write_tag(L, c->buf, MAR_C_END);
+}
+
 #define mar_incr_ptr(l) \
     if (((*p)-buf)+(ptrdiff_t)(l) > (ptrdiff_t)len) luaL_error(L, "bad code"); (*p) += (l);
 
@@ -333,6 +636,7 @@ static void mar_decode_value
 {
     size_t l;
     char val_type = **p;
+    luaL_checkstack(L, 8, "table too deeply nested");
     mar_incr_ptr(MAR_CHR);
     switch (val_type) {
     case LUA_TBOOLEAN:
@@ -477,11 +781,217 @@ static int mar_decode_table(lua_State *L, const char* buf, size_t len, size_t *i
     return 1;
 }
 
-int mar_encode(lua_State* L)
+typedef struct mar_Cursor {
+    const char *p;
+    const char *end;
+    size_t *idx;
+    size_t strings;
+} mar_Cursor;
+
+static void mar_compact_decode_body(lua_State *L, mar_Cursor *c);
+
+static int mar_read_tag(lua_State *L, mar_Cursor *c)
+{
+    if (c->p >= c->end) luaL_error(L, "bad code");
+    return (unsigned char)*c->p++;
+}
+
+static uint64_t mar_read_varint(lua_State *L, mar_Cursor *c)
+{
+    uint64_t val = 0;
+    int shift;
+    for (shift = 0; shift < 64; shift += 7) {
+        unsigned char byte = (unsigned char)mar_read_tag(L, c);
+        val |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return val;
+    }
+    luaL_error(L, "bad code");
+    return 0;
+}
+
+static const char* mar_read_bytes(lua_State *L, mar_Cursor *c, uint64_t len)
+{
+    const char *bytes = c->p;
+    if (len > (uint64_t)(c->end - c->p)) luaL_error(L, "bad code");
+    c->p += len;
+    return bytes;
+}
+
+static void mar_compact_decode_tagged(lua_State *L, mar_Cursor *c, int tag)
+{
+    luaL_checkstack(L, 8, "table too deeply nested");
+    switch (tag) {
+    case MAR_C_NIL:
+        lua_pushnil(L);
+        break;
+    case MAR_C_FALSE:
+    case MAR_C_TRUE:
+        lua_pushboolean(L, tag == MAR_C_TRUE);
+        break;
+    case MAR_C_INT: {
+        uint64_t zigzag = mar_read_varint(L, c);
+        int64_t int_val = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+#if LUA_VERSION_NUM >= 503
+        lua_pushinteger(L, (lua_Integer)int_val);
+#else
+        lua_pushnumber(L, (lua_Number)int_val);
+#endif
+        break;
+    }
+    case MAR_C_NUM: {
+        lua_Number num_val;
+        memcpy(&num_val, mar_read_bytes(L, c, MAR_I64), MAR_I64);
+        lua_pushnumber(L, num_val);
+        break;
+    }
+    case MAR_C_STR: {
+        uint64_t l = mar_read_varint(L, c);
+        const char *str_val = mar_read_bytes(L, c, l);
+        lua_pushlstring(L, str_val, (size_t)l);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, STRINGS_IDX, (int)++c->strings);
+        break;
+    }
+    case MAR_C_STRREF:
+    case MAR_C_REF: {
+        uint64_t ref = mar_read_varint(L, c);
+        if (ref > INT32_MAX) luaL_error(L, "bad code");
+        lua_rawgeti(L, tag == MAR_C_STRREF ? STRINGS_IDX : SEEN_IDX, (int)ref);
+        if (lua_isnil(L, -1)) luaL_error(L, "bad code");
+        break;
+    }
+    case MAR_C_TABLE:
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, SEEN_IDX, (int)(*c->idx)++);
+        mar_compact_decode_body(L, c);
+        break;
+    case MAR_C_PERSIST:
+        lua_newtable(L);
+        mar_compact_decode_body(L, c);
+        lua_rawgeti(L, -1, 1);
+        lua_call(L, 0, 1);
+        lua_remove(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, SEEN_IDX, (int)(*c->idx)++);
+        break;
+    case MAR_C_FUNC: {
+        unsigned int nups;
+        unsigned int i;
+        uint32_t l;
+        mar_Buffer dec_buf;
+
+        memcpy(&l, mar_read_bytes(L, c, MAR_I32), MAR_I32);
+        dec_buf.data = (char*)mar_read_bytes(L, c, l);
+        dec_buf.size = l;
+        dec_buf.head = l;
+        dec_buf.seek = 0;
+        if (lua_load(L, (lua_Reader)buf_read, &dec_buf, "=marshal", NULL) != 0)
+            lua_error(L);
+
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, SEEN_IDX, (int)(*c->idx)++);
+
+        lua_newtable(L);
+        mar_compact_decode_body(L, c);
+
+        lua_pushstring(L, MAR_ENV_IDX_KEY);
+        lua_rawget(L, -2);
+        if (lua_isnumber(L, -1)) {
+            lua_pushglobaltable(L);
+            lua_rawset(L, -3);
+        }
+        else {
+            lua_pop(L, 1);
+        }
+
+        lua_pushstring(L, MAR_NUPS_IDX_KEY);
+        lua_rawget(L, -2);
+        nups = luaL_checknumber(L, -1);
+        lua_pop(L, 1);
+
+        for (i = 1; i <= nups; i++) {
+            lua_rawgeti(L, -1, i);
+            lua_setupvalue(L, -3, i);
+        }
+
+        lua_pop(L, 1);
+        break;
+    }
+    default:
+        luaL_error(L, "bad code");
+    }
+}
+
+/* Decodes table contents into the table on top of the stack */
+static void mar_compact_decode_body(lua_State *L, mar_Cursor *c)
+{
+    uint64_t n = mar_read_varint(L, c);
+    uint64_t i;
+    int tag;
+
+    if (n > (uint64_t)(c->end - c->p)) luaL_error(L, "bad code");
+    for (i = 1; i <= n; i++) {
+        mar_compact_decode_tagged(L, c, mar_read_tag(L, c));
+        if (lua_isnil(L, -1))
+            lua_pop(L, 1);
+        else
+            lua_rawseti(L, -2, (int)i);
+    }
+
+    while ((tag = mar_read_tag(L, c)) != MAR_C_END) {
+        mar_compact_decode_tagged(L, c, tag);
+        if (lua_isnil(L, -1)) luaL_error(L, "bad code");
+        mar_compact_decode_tagged(L, c, mar_read_tag(L, c));
+        lua_rawset(L, -3);
+    }
+}
+
+/* Passed to mar_encode_body as light userdata */
+struct mar_EncodeArgs {
+    mar_Buffer *buf;
+    size_t *idx;
+    int compact;
+};
+
+/* Writes the value into the buffer and pushes the result, with the stack of mar_encode_format */
+static int mar_encode_body(lua_State* L)
+{
+    mar_EncodeArgs *args = (mar_EncodeArgs *)lua_touserdata(L, -1);
+    const unsigned char m = args->compact ? MAR_MAGIC_COMPACT : MAR_MAGIC;
+    mar_Buffer *buf = args->buf;
+    lua_pop(L, 1);
+
+    buf_write(L, (const char*)&m, 1, buf);
+
+    if (args->compact) {
+        const unsigned char version = MAR_COMPACT_VERSION;
+        mar_Compact c;
+        c.buf = buf;
+        c.idx = args->idx;
+        c.strings = 0;
+
+        buf_write(L, (const char*)&version, 1, buf);
+        lua_newtable(L); /* STRINGS_IDX */
+        mar_compact_encode_value(L, &c, 1);
+        lua_pop(L, 1);
+    }
+    else {
+        lua_pushvalue(L, 1);
+        mar_encode_value(L, buf, -1, args->idx);
+        lua_pop(L, 1);
+    }
+
+    lua_pushlstring(L, buf->data, buf->head);
+    return 1;
+}
+
+static int mar_encode_format(lua_State* L, int compact)
 {
-    const unsigned char m = MAR_MAGIC;
     size_t idx, len;
     mar_Buffer buf;
+    mar_EncodeArgs args;
+    int status;
 
     if (lua_isnone(L, 1)) {
         lua_pushnil(L);
@@ -505,33 +1015,56 @@ int mar_encode(lua_State* L)
         lua_pushinteger(L, idx);
         lua_rawset(L, SEEN_IDX);
     }
-    lua_pushvalue(L, 1);
+    buf_take_scratch(L, &buf);
 
-    buf_init(L, &buf);
-    buf_write(L, (const char*)&m, 1, &buf);
+    args.buf = &buf;
+    args.idx = &idx;
+    args.compact = compact;
 
-    mar_encode_value(L, &buf, -1, &idx);
-
-    lua_pop(L, 1);
-
-    lua_pushlstring(L, buf.data, buf.head);
-
-    buf_done(L, &buf);
+    /* Same stack for the body: value, table, seen */
+    lua_pushcfunction(L, mar_encode_body);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 2);
+    lua_pushvalue(L, SEEN_IDX);
+    lua_pushlightuserdata(L, &args);
+    status = lua_pcall(L, 4, 1, 0);
+
+    buf_return_scratch(L, &buf);
+    if (status != 0) {
+        return lua_error(L);
+    }
 
     lua_remove(L, SEEN_IDX);
 
     return 1;
 }
 
+int mar_encode(lua_State* L)
+{
+    return mar_encode_format(L, 0);
+}
+
+int mar_encode_compact(lua_State* L)
+{
+    return mar_encode_format(L, 1);
+}
+
 int mar_decode(lua_State* L)
 {
+    unsigned char magic;
     size_t l, idx, len;
     const char *p;
     const char *s = luaL_checklstring(L, 1, &l);
 
     if (l < 1) luaL_error(L, "bad header");
-    if (*(unsigned char *)s++ != MAR_MAGIC) luaL_error(L, "bad magic");
+    magic = *(unsigned char *)s++;
+    if (magic != MAR_MAGIC && magic != MAR_MAGIC_COMPACT) luaL_error(L, "bad magic");
     l -= 1;
+    if (magic == MAR_MAGIC_COMPACT) {
+        if (l < 1 || *(unsigned char *)s != MAR_COMPACT_VERSION) luaL_error(L, "bad version");
+        s++;
+        l -= 1;
+    }
 
     if (lua_isnoneornil(L, 2)) {
         lua_newtable(L);
@@ -548,8 +1081,21 @@ int mar_decode(lua_State* L)
         lua_rawseti(L, SEEN_IDX, idx);
     }
 
-    p = s;
-    mar_decode_value(L, s, l, &p, &idx);
+    if (magic == MAR_MAGIC_COMPACT) {
+        mar_Cursor c;
+        c.p = s;
+        c.end = s + l;
+        c.idx = &idx;
+        c.strings = 0;
+
+        lua_newtable(L); /* STRINGS_IDX */
+        mar_compact_decode_tagged(L, &c, mar_read_tag(L, &c));
+        lua_remove(L, STRINGS_IDX);
+    }
+    else {
+        p = s;
+        mar_decode_value(L, s, l, &p, &idx);
+    }
 
     lua_remove(L, SEEN_IDX);
     lua_remove(L, 2);
@@ -557,26 +1103,121 @@ int mar_decode(lua_State* L)
     return 1;
 }
 
+/*
+ * Copies the value at val and pushes the copy, walking the table graph once.
+ *
+ * SEEN_IDX maps every table already copied to its copy, so cycles and shared
+ *   tables are kept. Values with a __persist hook are copied by calling the
+ *   function it returns, like decoding would.
+ */
+static void mar_clone_value(lua_State *L, int val)
+{
+    int orig, copy;
+    luaL_checkstack(L, 8, "table too deeply nested");
+    lua_pushvalue(L, val);
+
+    if (!lua_istable(L, -1) && !lua_isuserdata(L, -1))
+        return;
+    if (lua_islightuserdata(L, -1))
+        return;
+
+    orig = lua_gettop(L);
+
+    lua_pushvalue(L, orig);
+    lua_rawget(L, SEEN_IDX);
+    if (!lua_isnil(L, -1)) {
+        lua_replace(L, orig);
+        return;
+    }
+    lua_pop(L, 1);
+
+    if (luaL_getmetafield(L, orig, "__persist")) {
+        lua_pushvalue(L, orig);
+        lua_call(L, 1, 1);
+        if (!lua_isfunction(L, -1)) {
+            luaL_error(L, "__persist must return a function");
+        }
+        lua_call(L, 0, 1);
+    }
+    else if (lua_istable(L, orig)) {
+        lua_newtable(L);
+        copy = lua_gettop(L);
+
+        lua_pushvalue(L, orig);
+        lua_pushvalue(L, copy);
+        lua_rawset(L, SEEN_IDX);
+
+        lua_pushnil(L);
+        while (lua_next(L, orig) != 0) {
+            mar_clone_value(L, -2);
+            mar_clone_value(L, -2);
+            lua_rawset(L, copy);
+            lua_pop(L, 1);
+        }
+    }
+    else {
+        luaL_error(L, "attempt to clone userdata (no __persist hook)");
+    }
+
+    lua_pushvalue(L, orig);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, SEEN_IDX);
+    lua_replace(L, orig);
+}
+
+/*
+ * Deep copies a value without encoding it. Values in the optional constants
+ *   table are not copied, and neither are functions, which are shared with
+ *   the original. Metatables are not copied, like with encode and decode.
+ */
 int mar_clone(lua_State* L)
 {
-    mar_encode(L);
-    lua_replace(L, 1);
-    mar_decode(L);
+    size_t idx, len;
+
+    if (lua_isnone(L, 1)) {
+        lua_pushnil(L);
+    }
+    if (lua_isnoneornil(L, 2)) {
+        lua_newtable(L);
+    }
+    else if (!lua_istable(L, 2)) {
+        luaL_error(L, "bad argument #2 to clone (expected table)");
+    }
+    lua_settop(L, 2);
+
+    len = lua_rawlen(L, 2);
+    lua_newtable(L);
+    for (idx = 1; idx <= len; idx++) {
+        lua_rawgeti(L, 2, idx);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            continue;
+        }
+        lua_pushvalue(L, -1);
+        lua_rawset(L, SEEN_IDX);
+    }
+
+    mar_clone_value(L, 1);
     return 1;
 }
 
 static const luaL_Reg R[] =
 {
-    {"encode",      mar_encode},
-    {"decode",      mar_decode},
-    {"clone",       mar_clone},
+    {"encode",          mar_encode},
+    {"encode_compact",  mar_encode_compact},
+    {"decode",          mar_decode},
+    {"clone",           mar_clone},
     {NULL,	    NULL}
 };
 
 int luaopen_marshal(lua_State *L)
 {
+    const luaL_Reg* reg;
     lua_newtable(L);
-    luaL_setfuncs(L, R, 0);
+    for (reg = R; reg->name; ++reg) {
+        lua_pushcfunction(L, reg->func);
+        lua_setfield(L, -2, reg->name);
+    }
     return 1;
 }
 
@@ -9,4 +9,10 @@ extern "C" {
 }
 
 int mar_encode(lua_State* L);
+// Like mar_encode, but writes the smaller compact format
+int mar_encode_compact(lua_State* L);
 int mar_decode(lua_State* L);
+// Deep copies a table, keeping cycles and shared tables
+int mar_clone(lua_State* L);
+// Pushes the `marshal` library table
+int luaopen_marshal(lua_State* L);